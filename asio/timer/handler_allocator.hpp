@@ -0,0 +1,119 @@
+#ifndef HANDLER_ALLOCATOR_HPP
+#define HANDLER_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <new>
+
+#include <boost/aligned_storage.hpp>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+// Recycled memory for the handlers of one chain of async operations, along
+// the lines of asio's allocation example. asio frees an operation's memory
+// before it makes the upcall, so a handler that immediately re-arms (like
+// heartbeat_check()) gets the very same block back every time. A couple of
+// slots cover the strand hop, where the strand's op and the timer's op can
+// briefly overlap. Anything that doesn't fit falls back to the heap.
+//
+// Slots are claimed with an atomic exchange, so an op completing on one
+// thread may hand its slot back while another thread arms the next one.
+class handler_memory : private boost::noncopyable {
+ public:
+  static const std::size_t slot_size = 256;
+  static const std::size_t slots = 2;
+
+  handler_memory() {
+    for (std::size_t i = 0; i < slots; ++i)
+      in_use_[i].store(false, boost::memory_order_relaxed);
+  }
+
+  void* allocate(std::size_t size) {
+    if (size <= slot_size) {
+      for (std::size_t i = 0; i < slots; ++i) {
+        if (!in_use_[i].exchange(true, boost::memory_order_acquire))
+          return storage_[i].address();
+      }
+    }
+    return ::operator new(size);
+  }
+
+  void deallocate(void* p) {
+    for (std::size_t i = 0; i < slots; ++i) {
+      if (p == storage_[i].address()) {
+        in_use_[i].store(false, boost::memory_order_release);
+        return;
+      }
+    }
+    ::operator delete(p);
+  }
+
+ private:
+  boost::aligned_storage<slot_size> storage_[slots];
+  boost::atomic<bool> in_use_[slots];
+};
+
+// Wraps a handler so that asio allocates its operations out of a
+// handler_memory. Other hooks are forwarded to the wrapped handler.
+template <typename Handler>
+class custom_alloc_handler {
+ public:
+  custom_alloc_handler(handler_memory& m, const Handler& h) : memory_(&m), handler_(h) {}
+
+  void operator()() { handler_(); }
+
+  template <typename Arg1>
+  void operator()(const Arg1& arg1) { handler_(arg1); }
+
+  template <typename Arg1, typename Arg2>
+  void operator()(const Arg1& arg1, const Arg2& arg2) { handler_(arg1, arg2); }
+
+  friend void* asio_handler_allocate(std::size_t size, custom_alloc_handler* this_handler) {
+    return this_handler->memory_->allocate(size);
+  }
+
+  friend void asio_handler_deallocate(void* p, std::size_t, custom_alloc_handler* this_handler) {
+    this_handler->memory_->deallocate(p);
+  }
+
+  template <typename Function>
+  friend void asio_handler_invoke(Function& function, custom_alloc_handler* this_handler) {
+    boost_asio_handler_invoke_helpers::invoke(function, this_handler->handler_);
+  }
+
+  template <typename Function>
+  friend void asio_handler_invoke(const Function& function, custom_alloc_handler* this_handler) {
+    boost_asio_handler_invoke_helpers::invoke(function, this_handler->handler_);
+  }
+
+ private:
+  handler_memory* memory_;
+  Handler handler_;
+};
+
+template <typename Handler>
+inline custom_alloc_handler<Handler>
+make_custom_alloc_handler(handler_memory& m, const Handler& h) {
+  return custom_alloc_handler<Handler>(m, h);
+}
+
+// Stamps out the allocate/deallocate/invoke hooks for a wrapper class whose
+// wrapped handler lives in handler_, so the wrapper is transparent to a
+// custom_alloc_handler (or a strand) underneath it.
+#define FORWARD_HANDLER_HOOKS(wrapper)                                        \
+  friend void* asio_handler_allocate(std::size_t size, wrapper* this_handler) { \
+    return boost_asio_handler_alloc_helpers::allocate(size, this_handler->handler_); \
+  }                                                                           \
+  friend void asio_handler_deallocate(void* p, std::size_t size, wrapper* this_handler) { \
+    boost_asio_handler_alloc_helpers::deallocate(p, size, this_handler->handler_); \
+  }                                                                           \
+  template <typename Function>                                                \
+  friend void asio_handler_invoke(Function& function, wrapper* this_handler) { \
+    boost_asio_handler_invoke_helpers::invoke(function, this_handler->handler_); \
+  }                                                                           \
+  template <typename Function>                                                \
+  friend void asio_handler_invoke(const Function& function, wrapper* this_handler) { \
+    boost_asio_handler_invoke_helpers::invoke(function, this_handler->handler_); \
+  }
+
+#endif // HANDLER_ALLOCATOR_HPP
@@ -0,0 +1,258 @@
+#ifndef HEARTBEAT_HPP
+#define HEARTBEAT_HPP
+
+#include <iostream>
+#include <ostream>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include "handler_allocator.hpp"
+#include "latency_histogram.hpp"
+
+// Lets main() hold on to heartbeats without caring which timer backs them.
+class heartbeat_base {
+ public:
+  virtual ~heartbeat_base() {}
+
+  // Cancel both timers. Their handlers still have to run (or be destroyed)
+  // before the heartbeat is, since their memory is the heartbeat's.
+  virtual void cancel() = 0;
+};
+
+// Runs a completion handler and records how long it sat between the timer
+// completing and getting to run (i.e. waiting on the strand), and how long
+// the handler itself took.
+template <typename Handler>
+class timed_handler {
+ public:
+  timed_handler(const Handler& handler, const boost::system::error_code& ec,
+                const boost::posix_time::ptime& completed)
+      : handler_(handler), ec_(ec), completed_(completed) {}
+
+  void operator()() {
+    latency_stats& stats = latency_stats::instance();
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    stats.record(serializer_wait, (start - completed_).total_microseconds());
+    handler_(ec_);
+    stats.record(handler_run, (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds());
+  }
+
+  FORWARD_HANDLER_HOOKS(timed_handler)
+
+ private:
+  Handler handler_;
+  boost::system::error_code ec_;
+  boost::posix_time::ptime completed_;
+};
+
+// Timer completion handler that notes when the timer completed and then
+// hands the real handler to the strand. This is what strand::wrap() does,
+// plus the timestamp.
+template <typename Handler>
+class strand_completion {
+ public:
+  strand_completion(boost::asio::io_service::strand& strand, const Handler& handler)
+      : strand_(&strand), handler_(handler) {}
+
+  void operator()(const boost::system::error_code& ec) {
+    strand_->dispatch(timed_handler<Handler>(handler_, ec,
+        boost::posix_time::microsec_clock::universal_time()));
+  }
+
+  FORWARD_HANDLER_HOOKS(strand_completion)
+
+ private:
+  boost::asio::io_service::strand* strand_;
+  Handler handler_;
+};
+
+// Same thing without a strand: the handler runs right away.
+template <typename Handler>
+class direct_completion {
+ public:
+  explicit direct_completion(const Handler& handler) : handler_(handler) {}
+
+  void operator()(const boost::system::error_code& ec) {
+    timed_handler<Handler> h(handler_, ec, boost::posix_time::microsec_clock::universal_time());
+    h();
+  }
+
+  FORWARD_HANDLER_HOOKS(direct_completion)
+
+ private:
+  Handler handler_;
+};
+
+// Serializer policies decide how a heartbeat's two handlers are kept from
+// running concurrently. When several threads run the io_service that takes
+// a strand. When the io_service is run by exactly one thread (sharded mode)
+// the handlers are already serialized and the strand is pure overhead.
+class strand_serializer {
+ public:
+  explicit strand_serializer(boost::asio::io_service& io) : strand_(io) {}
+
+  template <typename Timer, typename Handler>
+  void async_wait(Timer& t, Handler handler) {
+    t.async_wait(strand_completion<Handler>(strand_, handler));
+  }
+
+ private:
+  boost::asio::io_service::strand strand_;
+};
+
+class null_serializer {
+ public:
+  explicit null_serializer(boost::asio::io_service&) {}
+
+  template <typename Timer, typename Handler>
+  void async_wait(Timer& t, Handler handler) {
+    t.async_wait(direct_completion<Handler>(handler));
+  }
+};
+
+// Round t up to the next multiple of slack, counted from the epoch. Every
+// timer whose expiry falls in the same slack window then expires at the
+// exact same instant, so one reactor wakeup (or one wheel tick) fires them
+// all and their handlers get dispatched back to back. The cost is up to
+// slack worth of extra latency.
+inline boost::posix_time::ptime
+coalesce(const boost::posix_time::ptime& t, const boost::posix_time::time_duration& slack) {
+  boost::int64_t s = slack.total_microseconds();
+  if (s <= 0)
+    return t;
+
+  static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+  boost::int64_t r = (t - epoch).total_microseconds() % s;
+  return r == 0 ? t : t + boost::posix_time::microseconds(s - r);
+}
+
+// Simple heartbeat example with two timers being serviced by a thread pool.
+// Timer is either boost::asio::deadline_timer or wheel_timer: anything that
+// offers deadline_timer's expires_*(), async_wait() and cancel() will do.
+//
+// Each timer's handlers are allocated out of its own handler_memory, so once
+// both waits have been armed a tick doesn't touch the heap. Progress is
+// written to log, pass NULL to keep quiet. A non-zero slack coalesces
+// expirations, see coalesce().
+template <typename Timer, typename Serializer = strand_serializer>
+class basic_heartbeat : public heartbeat_base {
+ public:
+  basic_heartbeat(boost::asio::io_service& io,
+                  const boost::posix_time::time_duration& deadline,
+                  const boost::posix_time::time_duration& heartbeat_sleep,
+                  std::ostream* log = &std::cout,
+                  const boost::posix_time::time_duration& slack = boost::posix_time::time_duration())
+      : serializer_(io), deadline_(io), heartbeat_(io), slack_(slack), count_(0), log_(log)
+  {
+    // Set the deadline timer in the future
+    deadline_.expires_at(coalesce(Timer::traits_type::now() + deadline, slack_));
+    serializer_.async_wait(deadline_, make_custom_alloc_handler(deadline_memory_,
+        boost::bind(&basic_heartbeat::deadline_expired, this,
+                    boost::asio::placeholders::error)));
+
+    // And setup the heartbeat timer
+    arm_heartbeat(heartbeat_sleep);
+    serializer_.async_wait(heartbeat_, make_custom_alloc_handler(heartbeat_memory_,
+        boost::bind(&basic_heartbeat::heartbeat_check, this,
+                    boost::asio::placeholders::error,
+                    heartbeat_sleep)));
+  }
+
+  ~basic_heartbeat() {
+    if (log_)
+      *log_ << "Final heartbeat count: " << count_ << "\n";
+  }
+
+  int count() const { return count_; }
+
+  void cancel() {
+    deadline_.cancel();
+    heartbeat_.cancel();
+  }
+
+  // The deadline timer only fires when it's canceled by heartbeat_check() or
+  // when it actually expires. Pretend that the deadline timer is a really
+  // slow IO operation that can be canceled (e.g. imagine an async_read() or
+  // async_write() timing out).
+  void deadline_expired(const boost::system::error_code& e) {
+    if (e != boost::asio::error::operation_aborted)
+      latency_stats::instance().record(deadline_lateness,
+          (Timer::traits_type::now() - deadline_.expires_at()).total_microseconds());
+
+    if (e == boost::asio::error::operation_aborted) {
+      if (log_)
+        *log_ << "Deadline expired! Heartbeat canceled the deadline timer\n";
+    } else {
+      if (log_)
+        *log_ << "Deadline expired! Deadline timer timed out. Canceling heartbeat\n";
+      heartbeat_.cancel();
+    }
+  }
+
+  // The heartbeat_check() runs every heartbeat_sleep. If we've been canceled
+  // by the deadline_ timer, then we quietly slink off in to the night. If see
+  // that the deadline_ timer has expired but the deadline_ timer hasn't
+  // fired (for whatever goofy reason that won't happen in this example),
+  // cancel the deadline_ timer. Or, schedule another heartbeat for our
+  // fantastic little heartbeat_ self.
+  void heartbeat_check(const boost::system::error_code& e,
+                       const boost::posix_time::time_duration& heartbeat_sleep) {
+    // If we were canceled by the deadline timer, do nothing
+    if (e == boost::asio::error::operation_aborted) {
+      if (log_)
+        *log_ << "Heartbeat check was canceled by the deadline timer\n";
+      return;
+    }
+
+    // Lateness is measured against when the heartbeat was due, not the
+    // coalesced expiry, so that it includes the latency slack adds.
+    latency_stats& stats = latency_stats::instance();
+    stats.record(heartbeat_lateness,
+        (Timer::traits_type::now() - heartbeat_due_).total_microseconds());
+    stats.note_expiry(heartbeat_.expires_at());
+
+    // The heartbeat noticed the deadline timer has expired.
+    if (deadline_.expires_at() <= Timer::traits_type::now()) {
+      if (log_)
+        *log_ << "Heartbeat says the deadline timer expired! Canceling deadline timer.\n";
+      deadline_.cancel();
+
+      // Don't schedule any more events so that io_service::run() returns and
+      // threads join.
+      return;
+    }
+
+    // This is neato to see how the thread pool operates on the io_service
+    if (log_)
+      *log_ << "Heartbeat check #" << count_ << " from thread " << boost::this_thread::get_id() << "\n";
+    ++count_;
+
+    // Schedule another heartbeat
+    arm_heartbeat(heartbeat_sleep);
+    serializer_.async_wait(heartbeat_, make_custom_alloc_handler(heartbeat_memory_,
+        boost::bind(&basic_heartbeat::heartbeat_check, this,
+                    boost::asio::placeholders::error,
+                    heartbeat_sleep)));
+  }
+
+ private:
+  void arm_heartbeat(const boost::posix_time::time_duration& heartbeat_sleep) {
+    heartbeat_due_ = Timer::traits_type::now() + heartbeat_sleep;
+    heartbeat_.expires_at(coalesce(heartbeat_due_, slack_));
+  }
+
+  Serializer serializer_;
+  Timer deadline_;
+  Timer heartbeat_;
+  boost::posix_time::ptime heartbeat_due_;
+  const boost::posix_time::time_duration slack_;
+  handler_memory deadline_memory_;
+  handler_memory heartbeat_memory_;
+  int count_;
+  std::ostream* log_;
+};
+
+#endif // HEARTBEAT_HPP
@@ -0,0 +1,93 @@
+// Counts heap allocations made while heartbeats are ticking. Once every
+// heartbeat has armed its timers and every thread has touched its latency
+// histograms, a tick should not allocate at all. Exits non-zero if it does.
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread.hpp>
+
+#include "heartbeat.hpp"
+#include "io_service_pool.hpp"
+#include "timing_wheel.hpp"
+
+static boost::atomic<unsigned long> allocations(0);
+
+// Kept out of line so the compiler doesn't pair up inlined malloc()s and
+// free()s with new and delete expressions and complain about it.
+__attribute__((noinline)) void* operator new(std::size_t size) {
+  allocations.fetch_add(1, boost::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) throw() { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) throw() { std::free(p); }
+
+static const std::size_t heartbeats_per_run = 50;
+
+// Run heartbeats ticking every 5ms for a second and count what gets
+// allocated in the middle of the run. Returns the number of allocations
+// seen during the measured window.
+template <typename Heartbeat>
+static unsigned long
+steady_state_allocations(const char* name, std::size_t services, std::size_t threads_per_service) {
+  io_service_pool pool(services, threads_per_service, false, NULL);
+  boost::ptr_vector<Heartbeat> heartbeats;
+  for (std::size_t i = 0; i < heartbeats_per_run; ++i)
+    heartbeats.push_back(new Heartbeat(pool.get_io_service(),
+        boost::posix_time::seconds(1), boost::posix_time::milliseconds(5), NULL));
+
+  pool.start();
+
+  // Warm up: every thread runs a few ticks and sets up its histograms.
+  boost::this_thread::sleep(boost::posix_time::milliseconds(250));
+
+  int ticks_before = 0;
+  for (std::size_t i = 0; i < heartbeats.size(); ++i)
+    ticks_before += heartbeats[i].count();
+  unsigned long before = allocations.load();
+
+  boost::this_thread::sleep(boost::posix_time::milliseconds(500));
+
+  unsigned long after = allocations.load();
+  int ticks_after = 0;
+  for (std::size_t i = 0; i < heartbeats.size(); ++i)
+    ticks_after += heartbeats[i].count();
+
+  pool.join();
+
+  std::cout << name << ": " << (ticks_after - ticks_before) << " ticks, "
+            << (after - before) << " allocations\n";
+  if (ticks_after == ticks_before) {
+    std::cout << name << ": heartbeats didn't tick\n";
+    return 1;
+  }
+  return after - before;
+}
+
+int
+main() {
+  unsigned long failures = 0;
+
+  failures += steady_state_allocations<
+      basic_heartbeat<boost::asio::deadline_timer, strand_serializer> >(
+          "deadline_timer/pool", 1, 4);
+  failures += steady_state_allocations<
+      basic_heartbeat<boost::asio::deadline_timer, null_serializer> >(
+          "deadline_timer/shard", 4, 1);
+  failures += steady_state_allocations<
+      basic_heartbeat<wheel_timer, strand_serializer> >(
+          "wheel_timer/pool", 1, 4);
+  failures += steady_state_allocations<
+      basic_heartbeat<wheel_timer, null_serializer> >(
+          "wheel_timer/shard", 4, 1);
+
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,209 @@
+// Heartbeat scale benchmark: N heartbeats on M threads. Prints one JSON
+// object per run so results can be collected and compared across executor
+// layouts, serializers and timer backends on the same box.
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include "heartbeat.hpp"
+#include "io_service_pool.hpp"
+#include "latency_histogram.hpp"
+#include "timing_wheel.hpp"
+
+// A millisecond distribution given as "MS" (fixed) or "LO-HI" (uniform).
+class ms_distribution {
+ public:
+  explicit ms_distribution(const std::string& spec) {
+    std::string::size_type dash = spec.find('-');
+    if (dash == std::string::npos) {
+      lo_ = hi_ = boost::lexical_cast<uint32_t>(spec);
+    } else {
+      lo_ = boost::lexical_cast<uint32_t>(spec.substr(0, dash));
+      hi_ = boost::lexical_cast<uint32_t>(spec.substr(dash + 1));
+    }
+    if (hi_ < lo_)
+      std::swap(lo_, hi_);
+  }
+
+  template <typename Engine>
+  boost::posix_time::time_duration operator()(Engine& e) const {
+    boost::random::uniform_int_distribution<uint32_t> d(lo_, hi_);
+    return boost::posix_time::milliseconds(d(e));
+  }
+
+  std::string str() const {
+    return lo_ == hi_ ? boost::lexical_cast<std::string>(lo_)
+                      : boost::lexical_cast<std::string>(lo_) + "-" + boost::lexical_cast<std::string>(hi_);
+  }
+
+ private:
+  uint32_t lo_;
+  uint32_t hi_;
+};
+
+struct bench_config {
+  std::size_t count;
+  std::size_t nthreads;
+  bool sharded;
+  bool strand;
+  uint32_t wheel_tick;
+  uint32_t slack;
+  ms_distribution deadline;
+  ms_distribution interval;
+
+  bench_config()
+      : count(10000), nthreads(4), sharded(false), strand(true), wheel_tick(0), slack(0),
+        deadline("5000"), interval("100") {}
+};
+
+static double
+cpu_seconds(const struct rusage& ru) {
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+         ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void
+json_percentiles(std::ostream& os, const char* name, latency_metric m) {
+  latency_histogram h;
+  latency_stats::instance().merge(m, h);
+  os << "\"" << name << "_us\":{\"count\":" << h.count()
+     << ",\"p50\":" << h.percentile(50.0) << ",\"p99\":" << h.percentile(99.0)
+     << ",\"p999\":" << h.percentile(99.9) << ",\"max\":" << h.max() << "}";
+}
+
+template <typename Heartbeat>
+static int
+run(const bench_config& cfg) {
+  io_service_pool pool(cfg.sharded ? cfg.nthreads : 1, cfg.sharded ? 1 : cfg.nthreads,
+                       cfg.sharded, NULL);
+  if (cfg.wheel_tick > 0) {
+    for (std::size_t i = 0; i < pool.size(); ++i) {
+      boost::asio::io_service& io = pool.get_io_service(i);
+      boost::asio::add_service(io, new timing_wheel_service(io,
+          boost::posix_time::milliseconds(cfg.wheel_tick)));
+    }
+  }
+
+  boost::random::mt19937 rng(42);
+  boost::ptr_vector<Heartbeat> heartbeats;
+  heartbeats.reserve(cfg.count);
+
+  struct rusage ru_start;
+  ::getrusage(RUSAGE_SELF, &ru_start);
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+  for (std::size_t i = 0; i < cfg.count; ++i)
+    heartbeats.push_back(new Heartbeat(pool.get_io_service(),
+        cfg.deadline(rng), cfg.interval(rng), NULL,
+        boost::posix_time::milliseconds(cfg.slack)));
+
+  pool.start();
+  pool.join();
+
+  double wall = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+  struct rusage ru_end;
+  ::getrusage(RUSAGE_SELF, &ru_end);
+  double cpu = cpu_seconds(ru_end) - cpu_seconds(ru_start);
+  long csw = (ru_end.ru_nvcsw - ru_start.ru_nvcsw) + (ru_end.ru_nivcsw - ru_start.ru_nivcsw);
+
+  // Every tick is one arm plus one fire, and every deadline is one more.
+  unsigned long ticks = 0;
+  for (std::size_t i = 0; i < heartbeats.size(); ++i)
+    ticks += heartbeats[i].count();
+  unsigned long ops = ticks + heartbeats.size();
+
+  std::cout << "{\"heartbeats\":" << cfg.count
+            << ",\"threads\":" << cfg.nthreads
+            << ",\"executor\":\"" << (cfg.sharded ? "shard" : "pool") << "\""
+            << ",\"serializer\":\"" << (cfg.strand ? "strand" : "none") << "\""
+            << ",\"timer\":\"" << (cfg.wheel_tick > 0 ? "wheel" : "deadline_timer") << "\""
+            << ",\"wheel_tick_ms\":" << cfg.wheel_tick
+            << ",\"slack_ms\":" << cfg.slack
+            << ",\"deadline_ms\":\"" << cfg.deadline.str() << "\""
+            << ",\"interval_ms\":\"" << cfg.interval.str() << "\""
+            << ",\"wall_s\":" << wall
+            << ",\"cpu_s\":" << cpu
+            << ",\"ops\":" << ops
+            << ",\"ops_per_s\":" << (wall > 0 ? ops / wall : 0)
+            << ",\"cpu_ns_per_op\":" << (ops > 0 ? cpu * 1e9 / ops : 0)
+            << ",\"wakeups\":" << latency_stats::instance().wakeups()
+            << ",\"context_switches\":" << csw
+            << ",";
+  json_percentiles(std::cout, "skew", heartbeat_lateness);
+  std::cout << ",";
+  json_percentiles(std::cout, "serializer_wait", serializer_wait);
+  std::cout << ",";
+  json_percentiles(std::cout, "handler_run", handler_run);
+  std::cout << "}" << std::endl;
+
+  return 0;
+}
+
+static void
+usage() {
+  std::cout << "heartbeat_bench [-n count] [-t threads] [-s pool|shard] [-S strand|none]\n"
+            << "                [-w tick_ms] [-c slack_ms] [-d deadline_ms] [-i interval_ms]\n"
+            << "\t-n count\tNumber of heartbeats (default: 10000)\n"
+            << "\t-t threads\tNumber of threads (default: 4)\n"
+            << "\t-s pool|shard\tExecutor layout, see timer -s (default: pool)\n"
+            << "\t-S strand|none\tSerialize handlers with a strand or not (default: strand).\n"
+            << "\t\t\tnone is only safe when each io_service has one thread.\n"
+            << "\t-w tick_ms\tUse the timing wheel with a tick_ms granularity\n"
+            << "\t-c slack_ms\tCoalesce expirations in to slack_ms windows (default: 0)\n"
+            << "\t-d deadline_ms\tRun length per heartbeat, MS or LO-HI (default: 5000)\n"
+            << "\t-i interval_ms\tHeartbeat interval, MS or LO-HI (default: 100)\n";
+}
+
+int
+main(int argc, char* argv[]) {
+  bench_config cfg;
+
+  int ch;
+  while ((ch = ::getopt(argc, argv, "c:d:i:n:s:S:t:w:")) != -1) {
+    switch (ch) {
+      case 'c': cfg.slack = boost::lexical_cast<uint32_t>(optarg); break;
+      case 'd': cfg.deadline = ms_distribution(optarg); break;
+      case 'i': cfg.interval = ms_distribution(optarg); break;
+      case 'n': cfg.count = boost::lexical_cast<std::size_t>(optarg); break;
+      case 's': cfg.sharded = (std::string(optarg) == "shard"); break;
+      case 'S': cfg.strand = (std::string(optarg) != "none"); break;
+      case 't': cfg.nthreads = boost::lexical_cast<std::size_t>(optarg); break;
+      case 'w': cfg.wheel_tick = boost::lexical_cast<uint32_t>(optarg); break;
+      default:
+        usage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (cfg.nthreads == 0) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  // Without a strand a heartbeat's two handlers may run concurrently if
+  // more than one thread runs its io_service.
+  if (!cfg.strand && !cfg.sharded && cfg.nthreads > 1) {
+    std::cerr << "-S none needs -s shard or -t 1\n";
+    return EXIT_FAILURE;
+  }
+
+  if (cfg.wheel_tick > 0) {
+    if (cfg.strand)
+      return run<basic_heartbeat<wheel_timer, strand_serializer> >(cfg);
+    return run<basic_heartbeat<wheel_timer, null_serializer> >(cfg);
+  }
+  if (cfg.strand)
+    return run<basic_heartbeat<boost::asio::deadline_timer, strand_serializer> >(cfg);
+  return run<basic_heartbeat<boost::asio::deadline_timer, null_serializer> >(cfg);
+}
@@ -0,0 +1,123 @@
+#ifndef IO_SERVICE_POOL_HPP
+#define IO_SERVICE_POOL_HPP
+
+#include <pthread.h>
+#if defined(__FreeBSD__)
+# include <pthread_np.h>
+#endif
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+// A pool of io_services along the lines of the one in asio's HTTP server 2
+// example. Two shapes are interesting:
+//
+//   io_service_pool(1, N)  One io_service run by N threads. Everything
+//                          shares one reactor and handlers that touch the
+//                          same object need a strand.
+//   io_service_pool(N, 1)  One io_service per thread, i.e. sharded. Each
+//                          object lives on exactly one io_service, so its
+//                          handlers are already serialized and don't need
+//                          a strand. Threads can be pinned to a core.
+class io_service_pool : private boost::noncopyable {
+ public:
+  io_service_pool(std::size_t pool_size, std::size_t threads_per_service, bool pin = false,
+                  std::ostream* log = &std::cout)
+      : threads_per_service_(threads_per_service), pin_(pin), log_(log), next_(0)
+  {
+    if (pool_size == 0)
+      pool_size = 1;
+    for (std::size_t i = 0; i < pool_size; ++i)
+      io_services_.push_back(io_service_ptr(new boost::asio::io_service));
+  }
+
+  std::size_t size() const { return io_services_.size(); }
+
+  // Hand out io_services round-robin. Not thread safe: assign objects to
+  // shards before calling start().
+  boost::asio::io_service& get_io_service() {
+    boost::asio::io_service& io = *io_services_[next_];
+    next_ = (next_ + 1) % io_services_.size();
+    return io;
+  }
+
+  boost::asio::io_service& get_io_service(std::size_t i) {
+    return *io_services_[i % io_services_.size()];
+  }
+
+  // Start the threads. Threads inherit the caller's signal mask.
+  void start() {
+    std::size_t cpu = 0;
+    for (std::size_t i = 0; i < io_services_.size(); ++i) {
+      for (std::size_t j = 0; j < threads_per_service_; ++j, ++cpu) {
+        boost::thread* t = threads_.create_thread(boost::bind(
+            &io_service_pool::run, io_services_[i].get(), pin_, cpu));
+        if (log_)
+          *log_ << "Creating thread " << cpu << " with id " << t->get_id()
+                << " for io_service " << i << std::endl;
+      }
+    }
+  }
+
+  void stop() {
+    for (std::size_t i = 0; i < io_services_.size(); ++i)
+      io_services_[i]->stop();
+  }
+
+  void join() { threads_.join_all(); }
+
+  // Run whatever handlers are still queued (e.g. the operation_aborted ones
+  // left by canceling after a stop()) on the calling thread. Only after
+  // join().
+  void drain() {
+    for (std::size_t i = 0; i < io_services_.size(); ++i) {
+      io_services_[i]->reset();
+      io_services_[i]->poll();
+    }
+  }
+
+ private:
+  typedef boost::shared_ptr<boost::asio::io_service> io_service_ptr;
+
+  static void run(boost::asio::io_service* io, bool pin, std::size_t cpu) {
+    unsigned int ncpu = boost::thread::hardware_concurrency();
+    if (pin && ncpu > 0)
+      pin_to_cpu(cpu % ncpu);
+    io->run();
+  }
+
+  // Best effort: if the platform can't do it we simply run unpinned.
+  static void pin_to_cpu(std::size_t cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      std::cerr << "pthread_setaffinity_np(3) failed for cpu " << cpu << "\n";
+#elif defined(__FreeBSD__)
+    cpuset_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      std::cerr << "pthread_setaffinity_np(3) failed for cpu " << cpu << "\n";
+#else
+    (void)cpu;
+#endif
+  }
+
+  std::vector<io_service_ptr> io_services_;
+  boost::thread_group threads_;
+  const std::size_t threads_per_service_;
+  const bool pin_;
+  std::ostream* log_;
+  std::size_t next_;
+};
+
+#endif // IO_SERVICE_POOL_HPP
@@ -0,0 +1,125 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <cstddef>
+#include <iomanip>
+#include <ostream>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "log_histogram.hpp"
+
+// Microsecond latencies, see ../../histogram/log_histogram.hpp.
+typedef log_histogram latency_histogram;
+
+
+
+// What the heartbeat instrumentation records, all in microseconds.
+enum latency_metric {
+  heartbeat_lateness,  // heartbeat_check() start vs. when it was due
+  deadline_lateness,   // deadline_expired() start vs. deadline_'s expiry
+  serializer_wait,     // Timer completion until the handler got the strand
+  handler_run,         // Time spent inside the handler itself
+  latency_metric_count
+};
+
+// One set of histograms per thread, created on first use and kept until
+// the program exits so that they can still be merged after the threads
+// that wrote them are gone.
+class latency_stats : private boost::noncopyable {
+ public:
+  static latency_stats& instance() {
+    static latency_stats stats;
+    return stats;
+  }
+
+  // Negative values (a clock stepping backwards) count as 0.
+  void record(latency_metric m, boost::int64_t us) {
+    local().h[m].record(us < 0 ? 0 : static_cast<boost::uint64_t>(us));
+  }
+
+  // Approximates timer wakeups: a thread that fires several timers with
+  // the same expiry back to back did so off of one wakeup.
+  void note_expiry(const boost::posix_time::ptime& expiry) {
+    thread_histograms& t = local();
+    if (expiry != t.last_expiry) {
+      t.last_expiry = expiry;
+      t.wakeups.store(t.wakeups.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+    }
+  }
+
+  boost::uint64_t wakeups() {
+    boost::mutex::scoped_lock lk(mutex_);
+    boost::uint64_t n = 0;
+    for (std::size_t i = 0; i < threads_.size(); ++i)
+      n += threads_[i].wakeups.load(boost::memory_order_relaxed);
+    return n;
+  }
+
+  // Merge every thread's histogram for m in to out.
+  void merge(latency_metric m, latency_histogram& out) {
+    boost::mutex::scoped_lock lk(mutex_);
+    for (std::size_t i = 0; i < threads_.size(); ++i)
+      out.merge(threads_[i].h[m]);
+  }
+
+  void dump(std::ostream& os) {
+    static const char* const names[latency_metric_count] = {
+      "heartbeat_lateness", "deadline_lateness", "serializer_wait", "handler_run"
+    };
+
+    os << std::left << std::setw(20) << "Latency (us)" << std::right
+       << std::setw(10) << "count" << std::setw(10) << "p50"
+       << std::setw(10) << "p99" << std::setw(10) << "p999"
+       << std::setw(10) << "max" << "\n";
+    for (std::size_t m = 0; m < latency_metric_count; ++m) {
+      latency_histogram h;
+      merge(static_cast<latency_metric>(m), h);
+      os << std::left << std::setw(20) << names[m] << std::right
+         << std::setw(10) << h.count() << std::setw(10) << h.percentile(50.0)
+         << std::setw(10) << h.percentile(99.0) << std::setw(10) << h.percentile(99.9)
+         << std::setw(10) << h.max() << "\n";
+    }
+    os << std::left << std::setw(20) << "timer wakeups" << std::right
+       << std::setw(10) << wakeups() << "\n";
+  }
+
+ private:
+  struct thread_histograms {
+    thread_histograms() : wakeups(0) {}
+
+    latency_histogram h[latency_metric_count];
+    boost::posix_time::ptime last_expiry;
+    boost::atomic<boost::uint64_t> wakeups;
+  };
+
+  // The ptr_vector owns the histograms, so the tss cleanup is a no-op.
+  static void leave_alone(thread_histograms*) {}
+
+  latency_stats() : local_(&latency_stats::leave_alone) {}
+
+  thread_histograms& local() {
+    thread_histograms* t = local_.get();
+    if (!t) {
+      t = new thread_histograms;
+      {
+        boost::mutex::scoped_lock lk(mutex_);
+        threads_.push_back(t);
+      }
+      local_.reset(t);
+    }
+    return *t;
+  }
+
+  boost::mutex mutex_;
+  boost::ptr_vector<thread_histograms> threads_;
+  boost::thread_specific_ptr<thread_histograms> local_;
+};
+
+#endif // LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,296 @@
+#ifndef PEER_LIVENESS_HPP
+#define PEER_LIVENESS_HPP
+
+#if defined(__linux__)
+# include <sys/socket.h>
+#endif
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "handler_allocator.hpp"
+#include "phi_accrual.hpp"
+
+// Peer liveness over UDP: every interval a heartbeat datagram goes out to
+// each peer, and every datagram that comes in feeds that peer's phi accrual
+// detector. A peer is suspected once its phi crosses the threshold and
+// cleared as soon as it's heard from again.
+//
+// On Linux a whole round of heartbeats goes out with one sendmmsg(2) and
+// the socket is drained with recvmmsg(2), so a syscall moves up to
+// batch_size packets instead of one. asio only provides the readiness
+// notification (async_receive() with null_buffers). Elsewhere it falls
+// back to a send_to()/receive_from() loop. All buffers and mmsghdrs are
+// set up front, so steady state doesn't allocate.
+//
+// Everything runs on the io_service's thread(s) without a strand, so run
+// the io_service from one thread (or give each peer_liveness its own shard).
+class peer_liveness : private boost::noncopyable {
+ public:
+  typedef boost::asio::ip::udp udp;
+
+  static const std::size_t batch_size = 64;
+
+  peer_liveness(boost::asio::io_service& io, const udp::endpoint& listen,
+                const std::vector<udp::endpoint>& peers,
+                const boost::posix_time::time_duration& interval,
+                double threshold, std::ostream* log = &std::cout)
+      : socket_(io, listen), timer_(io), interval_(interval), threshold_(threshold),
+        log_(log), seq_(0), packets_sent_(0), packets_received_(0),
+        send_calls_(0), receive_calls_(0)
+  {
+    socket_.non_blocking(true);
+
+    for (std::size_t i = 0; i < peers.size(); ++i) {
+      peers_.push_back(peer(peers[i], interval));
+      index_[peers[i]] = i;
+    }
+
+#if defined(__linux__)
+    // One iovec for the (shared) outgoing payload, one mmsghdr per peer.
+    send_iov_.iov_base = payload_;
+    send_iov_.iov_len = sizeof(payload_);
+    send_msgs_.resize(peers_.size());
+    for (std::size_t i = 0; i < peers_.size(); ++i) {
+      std::memset(&send_msgs_[i], 0, sizeof(send_msgs_[i]));
+      send_msgs_[i].msg_hdr.msg_name = peers_[i].endpoint.data();
+      send_msgs_[i].msg_hdr.msg_namelen = peers_[i].endpoint.size();
+      send_msgs_[i].msg_hdr.msg_iov = &send_iov_;
+      send_msgs_[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    std::memset(recv_msgs_, 0, sizeof(recv_msgs_));
+    for (std::size_t i = 0; i < batch_size; ++i) {
+      recv_iov_[i].iov_base = recv_buf_[i];
+      recv_iov_[i].iov_len = sizeof(recv_buf_[i]);
+      recv_msgs_[i].msg_hdr.msg_name = &recv_addr_[i];
+      recv_msgs_[i].msg_hdr.msg_iov = &recv_iov_[i];
+      recv_msgs_[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+  }
+
+  void start() {
+    next_tick_ = boost::asio::deadline_timer::traits_type::now();
+    tick(boost::system::error_code());
+    start_receive();
+  }
+
+  void stop() {
+    boost::system::error_code ignored;
+    timer_.cancel(ignored);
+    socket_.close(ignored);
+  }
+
+  void dump(std::ostream& os) const {
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    for (std::size_t i = 0; i < peers_.size(); ++i) {
+      const peer& p = peers_[i];
+      os << "peer " << p.endpoint << " received=" << p.received
+         << " phi=" << p.detector.phi(now)
+         << (p.suspected ? " SUSPECTED" : "") << "\n";
+    }
+    os << "packets sent=" << packets_sent_ << " in " << send_calls_ << " syscalls, "
+       << "received=" << packets_received_ << " in " << receive_calls_ << " syscalls\n";
+  }
+
+ private:
+  struct peer {
+    peer(const udp::endpoint& ep, const boost::posix_time::time_duration& interval)
+        : endpoint(ep), detector(interval), suspected(false), received(0) {}
+
+    udp::endpoint endpoint;
+    phi_accrual_detector detector;
+    bool suspected;
+    unsigned long received;
+  };
+
+  // Heartbeat datagram: magic and sequence number, network byte order.
+  static const boost::uint32_t magic = 0x48425431;  // "HBT1"
+  static const std::size_t payload_size = 8;
+
+  void tick(const boost::system::error_code& e) {
+    if (e == boost::asio::error::operation_aborted)
+      return;
+
+    send_all();
+    check_peers(boost::posix_time::microsec_clock::universal_time());
+
+    // Schedule off of the previous tick rather than now so we don't drift.
+    next_tick_ += interval_;
+    timer_.expires_at(next_tick_);
+    timer_.async_wait(make_custom_alloc_handler(timer_memory_,
+        boost::bind(&peer_liveness::tick, this, boost::asio::placeholders::error)));
+  }
+
+  void send_all() {
+    boost::uint32_t m = htonl(magic), s = htonl(++seq_);
+    std::memcpy(payload_, &m, sizeof(m));
+    std::memcpy(payload_ + sizeof(m), &s, sizeof(s));
+
+#if defined(__linux__)
+    std::size_t sent = 0;
+    while (sent < send_msgs_.size()) {
+      // A copy of batch_size: it has no definition for std::min()'s
+      // reference to bind to
+      std::size_t n = std::min(send_msgs_.size() - sent, std::size_t(batch_size));
+      int rc = ::sendmmsg(socket_.native_handle(), &send_msgs_[sent], n, MSG_DONTWAIT);
+      ++send_calls_;
+      if (rc < 0) {
+        if (errno == EINTR)
+          continue;
+        // A full socket buffer fails every message after this one too, and
+        // a heartbeat is only worth sending now, so drop the rest of this
+        // round rather than queueing it.
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          break;
+        // Anything else (e.g. ECONNREFUSED left over from an ICMP error,
+        // or a peer that's unreachable) is about the first message only:
+        // skip that peer and carry on with the others.
+        ++sent;
+        continue;
+      }
+      sent += rc;
+      packets_sent_ += rc;
+    }
+#else
+    for (std::size_t i = 0; i < peers_.size(); ++i) {
+      boost::system::error_code ec;
+      socket_.send_to(boost::asio::buffer(payload_), peers_[i].endpoint, 0, ec);
+      ++send_calls_;
+      if (!ec)
+        ++packets_sent_;
+    }
+#endif
+  }
+
+  void check_peers(const boost::posix_time::ptime& now) {
+    for (std::size_t i = 0; i < peers_.size(); ++i) {
+      peer& p = peers_[i];
+      if (p.suspected || !p.detector.heard())
+        continue;
+      double phi = p.detector.phi(now);
+      if (phi >= threshold_) {
+        p.suspected = true;
+        if (log_)
+          *log_ << "SUSPECT " << p.endpoint << " phi=" << phi << std::endl;
+      }
+    }
+  }
+
+  void start_receive() {
+    socket_.async_receive(boost::asio::null_buffers(),
+        make_custom_alloc_handler(receive_memory_,
+            boost::bind(&peer_liveness::on_readable, this,
+                        boost::asio::placeholders::error)));
+  }
+
+  void on_readable(const boost::system::error_code& e) {
+    if (e == boost::asio::error::operation_aborted)
+      return;
+
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+#if defined(__linux__)
+    for (;;) {
+      for (std::size_t i = 0; i < batch_size; ++i)
+        recv_msgs_[i].msg_hdr.msg_namelen = sizeof(recv_addr_[i]);
+
+      int rc = ::recvmmsg(socket_.native_handle(), recv_msgs_, batch_size, MSG_DONTWAIT, NULL);
+      ++receive_calls_;
+      if (rc < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+
+      for (int i = 0; i < rc; ++i) {
+        udp::endpoint from;
+        std::memcpy(from.data(), &recv_addr_[i], recv_msgs_[i].msg_hdr.msg_namelen);
+        from.resize(recv_msgs_[i].msg_hdr.msg_namelen);
+        handle_datagram(from, recv_buf_[i], recv_msgs_[i].msg_len, now);
+      }
+
+      if (static_cast<std::size_t>(rc) < batch_size)
+        break;
+    }
+#else
+    for (;;) {
+      udp::endpoint from;
+      boost::system::error_code ec;
+      std::size_t n = socket_.receive_from(boost::asio::buffer(recv_buf_[0]), from, 0, ec);
+      ++receive_calls_;
+      if (ec)
+        break;
+      handle_datagram(from, recv_buf_[0], n, now);
+    }
+#endif
+
+    start_receive();
+  }
+
+  void handle_datagram(const udp::endpoint& from, const char* data, std::size_t len,
+                       const boost::posix_time::ptime& now) {
+    boost::uint32_t m;
+    if (len != payload_size)
+      return;
+    std::memcpy(&m, data, sizeof(m));
+    if (ntohl(m) != magic)
+      return;
+
+    std::map<udp::endpoint, std::size_t>::const_iterator it = index_.find(from);
+    if (it == index_.end())
+      return;
+
+    ++packets_received_;
+    peer& p = peers_[it->second];
+    ++p.received;
+    p.detector.heartbeat(now);
+    if (p.suspected) {
+      p.suspected = false;
+      if (log_)
+        *log_ << "ALIVE " << p.endpoint << std::endl;
+    }
+  }
+
+  udp::socket socket_;
+  boost::asio::deadline_timer timer_;
+  handler_memory timer_memory_;
+  handler_memory receive_memory_;
+  const boost::posix_time::time_duration interval_;
+  const double threshold_;
+  std::ostream* log_;
+
+  std::vector<peer> peers_;
+  std::map<udp::endpoint, std::size_t> index_;
+  boost::posix_time::ptime next_tick_;
+  boost::uint32_t seq_;
+  char payload_[payload_size];
+
+#if defined(__linux__)
+  iovec send_iov_;
+  std::vector<mmsghdr> send_msgs_;
+  mmsghdr recv_msgs_[batch_size];
+  iovec recv_iov_[batch_size];
+  sockaddr_storage recv_addr_[batch_size];
+#endif
+  char recv_buf_[batch_size][64];
+
+  unsigned long packets_sent_;
+  unsigned long packets_received_;
+  unsigned long send_calls_;
+  unsigned long receive_calls_;
+};
+
+#endif // PEER_LIVENESS_HPP
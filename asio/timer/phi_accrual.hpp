@@ -0,0 +1,96 @@
+#ifndef PHI_ACCRUAL_HPP
+#define PHI_ACCRUAL_HPP
+
+#include <cmath>
+#include <cstddef>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Phi accrual failure detector (Hayashibara et al., "The phi accrual
+// failure detector", 2004). Instead of a fixed deadline it keeps a window of
+// heartbeat inter-arrival times and turns "time since the last heartbeat"
+// in to a suspicion level:
+//
+//   phi = -log10(P(a heartbeat arrives later than now))
+//
+// so phi == 1 means a ~10% chance the peer is fine, phi == 3 means ~0.1%,
+// etc. The caller picks the threshold that suits it. The tail probability
+// uses the same logistic approximation of the normal CDF as Akka and
+// Cassandra, which behaves well far out in the tail.
+//
+// The window is a fixed ring buffer, so heartbeat() and phi() never
+// allocate.
+class phi_accrual_detector {
+ public:
+  static const std::size_t window = 128;
+
+  // expected_interval seeds the window so that phi is meaningful before
+  // the first few heartbeats arrive. min_stddev keeps a perfectly regular
+  // sender (e.g. on loopback) from making phi jump to infinity the moment
+  // a single heartbeat is a little late.
+  explicit phi_accrual_detector(
+      const boost::posix_time::time_duration& expected_interval,
+      const boost::posix_time::time_duration& min_stddev = boost::posix_time::milliseconds(50))
+      : min_stddev_ms_(min_stddev.total_microseconds() / 1000.0),
+        next_(0), size_(0), sum_(0), sum_sq_(0), heard_(false)
+  {
+    // Start off with mean == expected_interval and a generous deviation.
+    double ms = expected_interval.total_microseconds() / 1000.0;
+    add(ms - ms / 4);
+    add(ms + ms / 4);
+  }
+
+  // A heartbeat arrived at now.
+  void heartbeat(const boost::posix_time::ptime& now) {
+    if (heard_)
+      add((now - last_).total_microseconds() / 1000.0);
+    last_ = now;
+    heard_ = true;
+  }
+
+  // Suspicion level at now. 0 until the first heartbeat is heard.
+  double phi(const boost::posix_time::ptime& now) const {
+    if (!heard_)
+      return 0.0;
+
+    double elapsed = (now - last_).total_microseconds() / 1000.0;
+    double mean = sum_ / size_;
+    double variance = sum_sq_ / size_ - mean * mean;
+    double stddev = variance > 0 ? std::sqrt(variance) : 0;
+    if (stddev < min_stddev_ms_)
+      stddev = min_stddev_ms_;
+
+    double y = (elapsed - mean) / stddev;
+    double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+    if (elapsed > mean)
+      return -std::log10(e / (1.0 + e));
+    return -std::log10(1.0 - 1.0 / (1.0 + e));
+  }
+
+  bool heard() const { return heard_; }
+
+ private:
+  void add(double ms) {
+    if (size_ == window) {
+      sum_ -= samples_[next_];
+      sum_sq_ -= samples_[next_] * samples_[next_];
+    } else {
+      ++size_;
+    }
+    samples_[next_] = ms;
+    sum_ += ms;
+    sum_sq_ += ms * ms;
+    next_ = (next_ + 1) % window;
+  }
+
+  double min_stddev_ms_;
+  double samples_[window];
+  std::size_t next_;
+  std::size_t size_;
+  double sum_;
+  double sum_sq_;
+  boost::posix_time::ptime last_;
+  bool heard_;
+};
+
+#endif // PHI_ACCRUAL_HPP
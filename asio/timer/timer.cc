@@ -1,107 +1,122 @@
 #include <signal.h>
+#include <unistd.h>
 
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/thread.hpp>
 
-// Simple heartbeat example with two timers being serviced by a thread pool
-class heartbeat {
- public:
-  heartbeat(boost::asio::io_service& io, uint32_t deadline, uint32_t heartbeat_sleep)
-      : strand_(io), deadline_(io), heartbeat_(io), count_(0)
-  {
-    // Set the deadline timer in the future
-    deadline_.expires_from_now(boost::posix_time::seconds(deadline));
-    deadline_.async_wait(strand_.wrap(boost::bind(
-        &heartbeat::deadline_expired, this,
-        boost::asio::placeholders::error)));
-
-    // And setup the heartbeat timer
-    heartbeat_.expires_from_now(boost::posix_time::seconds(heartbeat_sleep));
-    heartbeat_.async_wait(strand_.wrap(boost::bind(
-        &heartbeat::heartbeat_check, this,
-        boost::asio::placeholders::error,
-        heartbeat_sleep)));
-  }
+#include "heartbeat.hpp"
+#include "io_service_pool.hpp"
+#include "latency_histogram.hpp"
+#include "timing_wheel.hpp"
+
+// Create count heartbeats, handing them out to the pool's io_services
+// round-robin.
+template <typename Heartbeat>
+static void
+make_heartbeats(io_service_pool& pool, std::size_t count, uint32_t deadline,
+                uint32_t interval, uint32_t slack,
+                boost::ptr_vector<heartbeat_base>& heartbeats) {
+  for (std::size_t i = 0; i < count; ++i)
+    heartbeats.push_back(new Heartbeat(pool.get_io_service(),
+        boost::posix_time::seconds(deadline), boost::posix_time::seconds(interval),
+        &std::cout, boost::posix_time::milliseconds(slack)));
+}
 
-  ~heartbeat() {
-    std::cout << "Final heartbeat count: " << count_ << "\n";
-  }
+static void
+usage() {
+  std::cout << "timer [-c slack_ms] [-n count] [-s pool|shard] [-t threads] [-w tick_ms] <deadline> <heartbeat_interval>\n"
+            << "\t-c slack_ms\tCoalesce expirations in to slack_ms windows (default: 0)\n"
+            << "\t-n count\tNumber of heartbeats to run (default: 1)\n"
+            << "\t-s pool\t\tOne io_service run by every thread, heartbeats use a strand (default)\n"
+            << "\t-s shard\tOne io_service per thread pinned to a core, no strands\n"
+            << "\t-t threads\tNumber of threads running io_services (default: 5)\n"
+            << "\t-w tick_ms\tUse the timing wheel backend with a tick_ms granularity\n";
+}
 
-  // The deadline timer only fires when it's canceled by heartbeat_check() or
-  // when it actually expires. Pretend that the deadline timer is a really
-  // slow IO operation that can be canceled (e.g. imagine an async_read() or
-  // async_write() timing out).
-  void deadline_expired(const boost::system::error_code& e) {
-    std::cout << "Deadline expired! ";
-    if (e == boost::asio::error::operation_aborted) {
-      std::cout << "Heartbeat canceled the deadline timer\n";
-    } else {
-      std::cout << "Deadline timer timed out. Canceling heartbeat\n";
-      heartbeat_.cancel();
+int
+main(int argc, char* argv[]) {
+  std::size_t count = 1;
+  std::size_t nthreads = 5;
+  bool sharded = false;
+  uint32_t wheel_tick = 0;
+  uint32_t slack = 0;
+
+  int ch;
+  while ((ch = ::getopt(argc, argv, "c:n:s:t:w:")) != -1) {
+    switch (ch) {
+      case 'c':
+        slack = boost::lexical_cast<uint32_t>(optarg);
+        break;
+      case 'n':
+        count = boost::lexical_cast<std::size_t>(optarg);
+        break;
+      case 's':
+        if (std::string(optarg) == "shard") {
+          sharded = true;
+        } else if (std::string(optarg) != "pool") {
+          usage();
+          return -1;
+        }
+        break;
+      case 't':
+        nthreads = boost::lexical_cast<std::size_t>(optarg);
+        break;
+      case 'w':
+        wheel_tick = boost::lexical_cast<uint32_t>(optarg);
+        break;
+      default:
+        usage();
+        return -1;
     }
   }
+  argc -= optind;
+  argv += optind;
 
-  // The heartbeat_check() runs every heartbeat_sleep seconds. If we've been
-  // canceled by the deadline_ timer, then we quietly slink off in to the
-  // night. If see that the deadline_ timer has expired but the deadline_
-  // timer hasn't fired (for whatever goofy reason that won't happen in this
-  // example), cancel the deadline_ timer. Or, schedule another heartbeat for
-  // our fantastic little heartbeat_ self.
-  void heartbeat_check(const boost::system::error_code& e, uint32_t heartbeat_sleep) {
-    // If we were canceled by the deadline timer, do nothing
-    if (e == boost::asio::error::operation_aborted) {
-      std::cout << "Heartbeat check was canceled by the deadline timer\n";
-      return;
-    }
-
-    // The heartbeat noticed the deadline timer has expired.
-    if (deadline_.expires_at() <= boost::asio::deadline_timer::traits_type::now()) {
-      std::cout << "Heartbeat says the deadline timer expired! Canceling deadline timer.\n";
-      deadline_.cancel();
+  if (argc != 2 || nthreads == 0) {
+    usage();
+    return -1;
+  }
 
-      // Don't schedule any more events so that io_service::run() returns and
-      // threads join.
-      return;
+  uint32_t deadline  = boost::lexical_cast<uint32_t>(argv[0]);
+  uint32_t interval = boost::lexical_cast<uint32_t>(argv[1]);
+
+  // Sharded: N io_services with a thread each. Pool: one io_service, N
+  // threads.
+  io_service_pool pool(sharded ? nthreads : 1, sharded ? 1 : nthreads, sharded);
+
+  // The timing wheel service has to be installed before the first
+  // wheel_timer asks for it, otherwise use_service<>() creates one with the
+  // default tick. Every shard gets its own wheel.
+  if (wheel_tick > 0) {
+    for (std::size_t i = 0; i < pool.size(); ++i) {
+      boost::asio::io_service& io = pool.get_io_service(i);
+      boost::asio::add_service(io, new timing_wheel_service(io,
+          boost::posix_time::milliseconds(wheel_tick)));
     }
-
-    // This is neato to see how the thread pool operates on the io_service
-    std::cout << "Heartbeat check #" << count_ << " from thread " << boost::this_thread::get_id() << "\n";
-    ++count_;
-
-    // Schedule another heartbeat
-    heartbeat_.expires_from_now(boost::posix_time::seconds(heartbeat_sleep));
-    heartbeat_.async_wait(strand_.wrap(boost::bind(
-        &heartbeat::heartbeat_check, this,
-        boost::asio::placeholders::error,
-        heartbeat_sleep)));
   }
 
- private:
-  boost::asio::strand strand_;
-  boost::asio::deadline_timer deadline_;
-  boost::asio::deadline_timer heartbeat_;
-  int count_;
-};
-
-int
-main(int argc, char* argv[]) {
-  if (argc != 3) {
-    std::cout << "timer <deadline> <heartbeat_interval>\n";
-    return -1;
+  // Declared after the pool so the heartbeats are destroyed first: a timer's
+  // destructor needs its io_service. Their handlers need the heartbeat, see
+  // the drain() below.
+  boost::ptr_vector<heartbeat_base> heartbeats;
+  if (wheel_tick > 0) {
+    if (sharded)
+      make_heartbeats<basic_heartbeat<wheel_timer, null_serializer> >(pool, count, deadline, interval, slack, heartbeats);
+    else
+      make_heartbeats<basic_heartbeat<wheel_timer, strand_serializer> >(pool, count, deadline, interval, slack, heartbeats);
+  } else {
+    if (sharded)
+      make_heartbeats<basic_heartbeat<boost::asio::deadline_timer, null_serializer> >(pool, count, deadline, interval, slack, heartbeats);
+    else
+      make_heartbeats<basic_heartbeat<boost::asio::deadline_timer, strand_serializer> >(pool, count, deadline, interval, slack, heartbeats);
   }
 
-  uint32_t deadline  = boost::lexical_cast<uint32_t>(argv[1]);
-  uint32_t interval = boost::lexical_cast<uint32_t>(argv[2]);
-
-  boost::asio::io_service io;
-  heartbeat h(io, deadline, interval);
-
   std::cout << "Main thread has ID " << boost::this_thread::get_id() << std::endl;
-  boost::thread_group threads;
 
   // Mask all signals. New threads inherit from their parent.
   sigset_t filled_mask, old_mask;
@@ -111,11 +126,8 @@ main(int argc, char* argv[]) {
     return -1;
   }
 
-  // Kick off 5 threads
-  for (size_t i = 0; i < 5; ++i) {
-    boost::thread* t = threads.create_thread(boost::bind(&boost::asio::io_service::run, &io));
-    std::cout << "Creating thread " << i << " with id " << t->get_id() << std::endl;
-  }
+  // Kick off the threads
+  pool.start();
 
   // Restore the original signal mask.
   if (pthread_sigmask(SIG_SETMASK, &old_mask, NULL) != 0) {
@@ -148,16 +160,27 @@ main(int argc, char* argv[]) {
     return -1;
   }
 
+  // Attempt to shutdown anyway
+  pool.stop();
 #else /* CLIENT MODE */
-  // Clients terminate when they finish the task at hand.
-  io.run();
+  // Clients terminate when they finish the task at hand: every io_service
+  // runs out of work and its threads return from run().
 #endif
 
-  // Attempt to shutdown anyway
-  io.stop();
-
   // Wait for all threads to join
-  threads.join_all();
+  pool.join();
+
+  // After a stop() the heartbeats' handlers are still queued, allocated out
+  // of each heartbeat's handler_memory. Cancel every timer and run what's
+  // left so that nothing in an io_service points in to a heartbeat by the
+  // time the heartbeats are freed.
+  for (std::size_t i = 0; i < heartbeats.size(); ++i)
+    heartbeats[i].cancel();
+  pool.drain();
+
+  std::cout << "\n";
+  latency_stats::instance().dump(std::cout);
+  std::cout << "\n";
 
   return 0;
 }
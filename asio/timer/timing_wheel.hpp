@@ -0,0 +1,400 @@
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+
+#include <cstddef>
+#include <new>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "handler_allocator.hpp"
+
+// Hashed hierarchical timing wheel (Varghese & Lauck's "scheme 7", the same
+// layout the Linux kernel used for years) that plugs in to an io_service as
+// a service. deadline_timer keeps every pending wait in a heap, so each arm
+// and cancel is O(log n). Here a timer is hashed in to a slot by its expiry
+// tick and linked in to an intrusive list, which makes arm and cancel O(1).
+// The price is resolution: expirations are rounded up to the next tick.
+//
+// The whole wheel is driven by a single deadline_timer that is only armed
+// while at least one wheel_timer is pending, so io_service::run() still
+// returns once there's no more work to do.
+//
+// Usage: optionally install the service with the desired granularity before
+// creating any wheel_timer (the default tick is 1ms):
+//
+//   boost::asio::add_service(io, new timing_wheel_service(io,
+//       boost::posix_time::milliseconds(10)));
+//   wheel_timer t(io);  // Same interface as deadline_timer.
+
+namespace timing_wheel_detail {
+
+// Binds the error_code to a completion handler and forwards asio's handler
+// hooks so that strand-wrapped handlers (or handlers with custom allocators)
+// behave exactly the same as they would with a deadline_timer.
+template <typename Handler>
+class wait_binder {
+ public:
+  wait_binder(const Handler& handler, const boost::system::error_code& ec)
+      : handler_(handler), ec_(ec) {}
+
+  void operator()() { handler_(ec_); }
+
+  FORWARD_HANDLER_HOOKS(wait_binder)
+
+ private:
+  Handler handler_;
+  boost::system::error_code ec_;
+};
+
+// Type erased pending wait. complete() releases the op's memory and, when
+// given an io_service, posts the handler with the supplied error_code. A NULL
+// io_service only destroys the op (used at shutdown).
+class wait_op {
+ public:
+  void complete(boost::asio::io_service* io, const boost::system::error_code& ec) {
+    func_(this, io, ec);
+  }
+
+ protected:
+  typedef void (*func_type)(wait_op*, boost::asio::io_service*,
+                            const boost::system::error_code&);
+  explicit wait_op(func_type func) : func_(func) {}
+  ~wait_op() {}
+
+ private:
+  func_type func_;
+};
+
+template <typename Handler>
+class wait_handler_op : public wait_op {
+ public:
+  explicit wait_handler_op(const Handler& handler)
+      : wait_op(&wait_handler_op::do_complete), handler_(handler) {}
+
+  static void do_complete(wait_op* base, boost::asio::io_service* io,
+                          const boost::system::error_code& ec) {
+    wait_handler_op* op = static_cast<wait_handler_op*>(base);
+
+    // Take a copy of the handler so that the op's memory can be handed back
+    // before the upcall is made, same as asio does for its own ops.
+    Handler handler(op->handler_);
+    op->~wait_handler_op();
+    boost_asio_handler_alloc_helpers::deallocate(op, sizeof(wait_handler_op), handler);
+
+    if (io)
+      io->post(wait_binder<Handler>(handler, ec));
+  }
+
+ private:
+  Handler handler_;
+};
+
+// Per-timer state owned by the wheel_timer and linked in to a wheel slot
+// while a wait is pending.
+struct timer_node {
+  timer_node() : pprev_(0), next_(0), when_(0), op_(0) {}
+
+  // hlist-style linkage: pprev_ points at whichever pointer points at us
+  // (the slot head or the previous node's next_) so unlink is O(1).
+  timer_node** pprev_;
+  timer_node* next_;
+  boost::uint64_t when_;  // Expiry, in ticks since the service's origin
+  wait_op* op_;           // Non-NULL iff the node is linked in to a slot
+};
+
+} // namespace timing_wheel_detail
+
+
+
+class timing_wheel_service
+    : public boost::asio::detail::service_base<timing_wheel_service> {
+ public:
+  typedef boost::asio::deadline_timer::traits_type traits_type;
+  typedef boost::posix_time::ptime time_type;
+  typedef boost::posix_time::time_duration duration_type;
+  typedef timing_wheel_detail::timer_node node_type;
+  typedef timing_wheel_detail::wait_op op_type;
+
+  explicit timing_wheel_service(boost::asio::io_service& io,
+                                const duration_type& tick = boost::posix_time::milliseconds(1))
+      : boost::asio::detail::service_base<timing_wheel_service>(io),
+        io_(io), tick_timer_(io), origin_(traits_type::now()),
+        tick_us_(tick.total_microseconds() > 0 ? tick.total_microseconds() : 1),
+        current_(0), next_wake_(0), armed_(0), running_(false), shutdown_(false)
+  {
+    for (std::size_t lvl = 0; lvl < levels; ++lvl)
+      for (std::size_t i = 0; i < slots; ++i)
+        slot_[lvl][i] = 0;
+  }
+
+  boost::asio::io_service& get_io_service() { return io_; }
+
+  duration_type granularity() const {
+    return boost::posix_time::microseconds(tick_us_);
+  }
+
+  // Arm node to fire op at expiry. Any wait already pending on node is
+  // canceled first, which mirrors deadline_timer::async_wait() semantics
+  // when paired with expires_at()/expires_from_now().
+  void schedule(node_type& node, const time_type& expiry, op_type* op) {
+    boost::mutex::scoped_lock lk(mutex_);
+    if (shutdown_) {
+      op->complete(0, boost::system::error_code());
+      return;
+    }
+
+    cancel_locked(node);
+
+    // An empty wheel that isn't being driven has a stale notion of "now".
+    // Nothing is linked in, so it is safe to simply jump ahead.
+    if (armed_ == 0 && !running_)
+      current_ = ticks_at(traits_type::now());
+
+    boost::uint64_t when = ticks_until(expiry);
+    if (when <= current_) {
+      // Already expired, complete immediately like deadline_timer does.
+      op->complete(&io_, boost::system::error_code());
+      return;
+    }
+
+    node.when_ = when;
+    node.op_ = op;
+    link(node);
+    ++armed_;
+
+    // The driver never sleeps past the next level 1 boundary, which keeps
+    // advance() from having to walk more than one level's worth of ticks.
+    if (!running_ || when < next_wake_)
+      drive(next_tick());
+  }
+
+  // Unlink node and complete its pending wait with operation_aborted.
+  // Returns the number of waits canceled (0 or 1).
+  std::size_t cancel(node_type& node) {
+    boost::mutex::scoped_lock lk(mutex_);
+    return cancel_locked(node);
+  }
+
+ private:
+  static const std::size_t level_bits = 8;
+  static const std::size_t slots = 1 << level_bits;
+  static const std::size_t slot_mask = slots - 1;
+  static const std::size_t levels = 4;
+
+  // asio calls this when the io_service is destroyed. Pending handlers are
+  // destroyed without being invoked, same as the built-in services.
+  void shutdown_service() {
+    boost::mutex::scoped_lock lk(mutex_);
+    shutdown_ = true;
+    for (std::size_t lvl = 0; lvl < levels; ++lvl) {
+      for (std::size_t i = 0; i < slots; ++i) {
+        while (node_type* n = slot_[lvl][i]) {
+          unlink(*n);
+          op_type* op = n->op_;
+          n->op_ = 0;
+          op->complete(0, boost::system::error_code());
+        }
+      }
+    }
+    armed_ = 0;
+  }
+
+  std::size_t cancel_locked(node_type& node) {
+    if (!node.op_)
+      return 0;
+
+    unlink(node);
+    --armed_;
+    op_type* op = node.op_;
+    node.op_ = 0;
+    op->complete(&io_, boost::asio::error::operation_aborted);
+    return 1;
+  }
+
+  boost::uint64_t ticks_at(const time_type& t) const {
+    boost::int64_t us = (t - origin_).total_microseconds();
+    return us > 0 ? static_cast<boost::uint64_t>(us / tick_us_) : 0;
+  }
+
+  // Round up so that a timer never fires before its expiry.
+  boost::uint64_t ticks_until(const time_type& t) const {
+    boost::int64_t us = (t - origin_).total_microseconds();
+    return us > 0 ? static_cast<boost::uint64_t>((us + tick_us_ - 1) / tick_us_) : 0;
+  }
+
+  time_type time_of(boost::uint64_t tick) const {
+    return origin_ + boost::posix_time::microseconds(static_cast<boost::int64_t>(tick) * tick_us_);
+  }
+
+  // Hash the node in to the finest level that can represent its distance
+  // from current_. Nodes further out than the wheel's span park in the last
+  // slot of the top level and get re-hashed every time it cascades.
+  void link(node_type& node) {
+    boost::uint64_t delta = node.when_ - current_;
+    std::size_t lvl = 0;
+    while (lvl + 1 < levels && delta >= (static_cast<boost::uint64_t>(1) << (level_bits * (lvl + 1))))
+      ++lvl;
+
+    boost::uint64_t when = node.when_;
+    const boost::uint64_t span = static_cast<boost::uint64_t>(1) << (level_bits * levels);
+    if (delta >= span)
+      when = current_ + span - 1;
+
+    node_type*& head = slot_[lvl][(when >> (level_bits * lvl)) & slot_mask];
+    node.next_ = head;
+    if (head)
+      head->pprev_ = &node.next_;
+    node.pprev_ = &head;
+    head = &node;
+  }
+
+  void unlink(node_type& node) {
+    *node.pprev_ = node.next_;
+    if (node.next_)
+      node.next_->pprev_ = node.pprev_;
+    node.pprev_ = 0;
+    node.next_ = 0;
+  }
+
+  // Re-hash every node in slot i of level lvl. Called when current_ crosses
+  // that slot's boundary, which moves the nodes down towards level 0.
+  void cascade(std::size_t lvl, std::size_t i) {
+    node_type* n = slot_[lvl][i];
+    slot_[lvl][i] = 0;
+    while (n) {
+      node_type* next = n->next_;
+      link(*n);
+      n = next;
+    }
+  }
+
+  // Process every tick up to and including target.
+  void advance(boost::uint64_t target) {
+    while (current_ < target) {
+      ++current_;
+
+      for (std::size_t lvl = 1; lvl < levels; ++lvl) {
+        if ((current_ & ((static_cast<boost::uint64_t>(1) << (level_bits * lvl)) - 1)) != 0)
+          break;
+        cascade(lvl, (current_ >> (level_bits * lvl)) & slot_mask);
+      }
+
+      while (node_type* n = slot_[0][current_ & slot_mask]) {
+        unlink(*n);
+        op_type* op = n->op_;
+        n->op_ = 0;
+        --armed_;
+        op->complete(&io_, boost::system::error_code());
+      }
+    }
+  }
+
+  // Earliest tick worth waking up for: the next occupied level 0 slot, or
+  // the next level 1 boundary if level 0 is empty.
+  boost::uint64_t next_tick() const {
+    for (std::size_t i = 1; i < slots; ++i) {
+      boost::uint64_t t = current_ + i;
+      if ((t & slot_mask) == 0 || slot_[0][t & slot_mask])
+        return t;
+    }
+    return current_ + slots;
+  }
+
+  void drive(boost::uint64_t tick) {
+    running_ = true;
+    next_wake_ = tick;
+    tick_timer_.expires_at(time_of(tick));
+    tick_timer_.async_wait(make_custom_alloc_handler(tick_memory_,
+        boost::bind(&timing_wheel_service::on_tick, this,
+                    boost::asio::placeholders::error)));
+  }
+
+  void on_tick(const boost::system::error_code& e) {
+    // Aborted waits come from drive() pulling the wakeup in earlier or from
+    // shutdown. Either way someone else owns the driver now.
+    if (e == boost::asio::error::operation_aborted)
+      return;
+
+    boost::mutex::scoped_lock lk(mutex_);
+    if (shutdown_)
+      return;
+
+    advance(ticks_at(traits_type::now()));
+    if (armed_ > 0)
+      drive(next_tick());
+    else
+      running_ = false;
+  }
+
+  boost::asio::io_service& io_;
+  boost::mutex mutex_;
+  boost::asio::deadline_timer tick_timer_;
+  handler_memory tick_memory_;
+  const time_type origin_;
+  const boost::int64_t tick_us_;
+  boost::uint64_t current_;    // Last tick processed
+  boost::uint64_t next_wake_;  // Tick tick_timer_ is armed for
+  std::size_t armed_;
+  bool running_;
+  bool shutdown_;
+  node_type* slot_[levels][slots];
+};
+
+
+
+// Drop-in replacement for boost::asio::deadline_timer backed by the
+// timing_wheel_service. Only one wait may be outstanding per timer, which is
+// all heartbeat needs.
+class wheel_timer : private boost::noncopyable {
+ public:
+  typedef timing_wheel_service::traits_type traits_type;
+  typedef timing_wheel_service::time_type time_type;
+  typedef timing_wheel_service::duration_type duration_type;
+
+  explicit wheel_timer(boost::asio::io_service& io)
+      : service_(boost::asio::use_service<timing_wheel_service>(io)) {}
+
+  ~wheel_timer() { service_.cancel(node_); }
+
+  boost::asio::io_service& get_io_service() { return service_.get_io_service(); }
+
+  time_type expires_at() const { return expiry_; }
+
+  std::size_t expires_at(const time_type& expiry) {
+    std::size_t n = service_.cancel(node_);
+    expiry_ = expiry;
+    return n;
+  }
+
+  std::size_t expires_from_now(const duration_type& d) {
+    return expires_at(traits_type::now() + d);
+  }
+
+  std::size_t cancel() { return service_.cancel(node_); }
+
+  template <typename WaitHandler>
+  void async_wait(WaitHandler handler) {
+    typedef timing_wheel_detail::wait_handler_op<WaitHandler> op;
+    void* mem = boost_asio_handler_alloc_helpers::allocate(sizeof(op), handler);
+    op* o;
+    try {
+      o = new (mem) op(handler);
+    } catch (...) {
+      boost_asio_handler_alloc_helpers::deallocate(mem, sizeof(op), handler);
+      throw;
+    }
+    service_.schedule(node_, expiry_, o);
+  }
+
+ private:
+  timing_wheel_service& service_;
+  timing_wheel_detail::timer_node node_;
+  time_type expiry_;
+};
+
+#endif // TIMING_WHEEL_HPP
@@ -0,0 +1,98 @@
+// UDP heartbeats between processes with a phi accrual failure detector.
+// Start a few of these on loopback pointing at each other, kill one, and
+// watch the others suspect it. See udp_heartbeat_test.sh.
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "peer_liveness.hpp"
+
+using boost::asio::ip::udp;
+
+// "host:port" or just "port", which means 127.0.0.1:port.
+static udp::endpoint
+parse_endpoint(const std::string& s) {
+  std::string::size_type colon = s.rfind(':');
+  if (colon == std::string::npos)
+    return udp::endpoint(boost::asio::ip::address_v4::loopback(),
+                         boost::lexical_cast<unsigned short>(s));
+  return udp::endpoint(boost::asio::ip::address::from_string(s.substr(0, colon)),
+                       boost::lexical_cast<unsigned short>(s.substr(colon + 1)));
+}
+
+static void
+usage() {
+  std::cout << "udp_heartbeat [-d seconds] [-i interval_ms] [-p phi] <listen> <peer> [peer...]\n"
+            << "\t-d seconds\tExit after this long (default: run until SIGINT/SIGTERM)\n"
+            << "\t-i interval_ms\tHeartbeat interval (default: 100)\n"
+            << "\t-p phi\t\tSuspicion threshold (default: 8)\n"
+            << "\tlisten and peers are host:port, or a port on 127.0.0.1\n";
+}
+
+static void
+shutdown(peer_liveness* liveness, boost::asio::signal_set* signals,
+         boost::asio::deadline_timer* timer) {
+  liveness->stop();
+  signals->cancel();
+  timer->cancel();
+}
+
+int
+main(int argc, char* argv[]) {
+  uint32_t duration = 0;
+  uint32_t interval = 100;
+  double threshold = 8.0;
+
+  int ch;
+  while ((ch = ::getopt(argc, argv, "d:i:p:")) != -1) {
+    switch (ch) {
+      case 'd': duration = boost::lexical_cast<uint32_t>(optarg); break;
+      case 'i': interval = boost::lexical_cast<uint32_t>(optarg); break;
+      case 'p': threshold = boost::lexical_cast<double>(optarg); break;
+      default:
+        usage();
+        return EXIT_FAILURE;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+
+  if (argc < 2 || interval == 0) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  udp::endpoint listen = parse_endpoint(argv[0]);
+  std::vector<udp::endpoint> peers;
+  for (int i = 1; i < argc; ++i)
+    peers.push_back(parse_endpoint(argv[i]));
+
+  boost::asio::io_service io;
+  peer_liveness liveness(io, listen, peers, boost::posix_time::milliseconds(interval), threshold);
+
+  // One thread runs everything, so no strand. Either a signal or the
+  // duration running out winds things down.
+  boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+  boost::asio::deadline_timer stop_timer(io);
+  signals.async_wait(boost::bind(&shutdown, &liveness, &signals, &stop_timer));
+  if (duration > 0) {
+    stop_timer.expires_from_now(boost::posix_time::seconds(duration));
+    stop_timer.async_wait(boost::bind(&shutdown, &liveness, &signals, &stop_timer));
+  }
+
+  std::cout << "Listening on " << listen << " with " << peers.size() << " peers" << std::endl;
+  liveness.start();
+  io.run();
+
+  liveness.dump(std::cout);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Three udp_heartbeat processes on loopback. Node C is killed part way
+# through: A and B must suspect C and must not suspect each other.
+
+PROG=${PROG:-./udp_heartbeat}
+A=127.0.0.1:17001
+B=127.0.0.1:17002
+C=127.0.0.1:17003
+TMP=${TMPDIR:-/tmp}/udp_heartbeat_test.$$
+
+mkdir -p ${TMP} || exit 1
+trap 'rm -rf ${TMP}' EXIT
+
+${PROG} -d 4 -i 50 ${A} ${B} ${C} > ${TMP}/a.out 2>&1 &
+${PROG} -d 4 -i 50 ${B} ${A} ${C} > ${TMP}/b.out 2>&1 &
+${PROG} -d 4 -i 50 ${C} ${A} ${B} > ${TMP}/c.out 2>&1 &
+PID_C=$!
+
+sleep 2
+kill -9 ${PID_C}
+wait
+
+rc=0
+for node in a b; do
+	if ! grep -q "^SUSPECT ${C} " ${TMP}/${node}.out; then
+		echo "FAIL: node ${node} never suspected ${C}"
+		rc=1
+	fi
+done
+if grep -q "^SUSPECT ${B} " ${TMP}/a.out || grep -q "^SUSPECT ${A} " ${TMP}/b.out; then
+	echo "FAIL: a live peer was suspected"
+	rc=1
+fi
+
+if [ ${rc} -ne 0 ]; then
+	cat ${TMP}/a.out ${TMP}/b.out
+else
+	echo "PASS"
+	cat ${TMP}/a.out
+fi
+exit ${rc}
@@ -0,0 +1,257 @@
+#ifndef CIVIL_BATCH_HPP
+#define CIVIL_BATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+# include <immintrin.h>
+# define CIVIL_BATCH_X86 1
+#else
+# define CIVIL_BATCH_X86 0
+#endif
+
+namespace civil_batch {
+
+// Bulk time_t to UTC calendar fields, for when from_time_t(t).date() one
+// value at a time is too slow: n timestamps in, six columns out.
+//
+// Days from seconds is a floor division by 86400, and the date from days is
+// Howard Hinnant's civil_from_days() with the epoch shifted so every day in
+// range is non-negative, which removes its only branch. The SIMD versions
+// do the 64-bit part in doubles (every time_t in range is exact in one)
+// and the rest in 32-bit lanes, with each division by a constant done as a
+// float division and truncated: all the dividends are small enough that
+// the float quotient can't round across an integer, which
+// time_unittests' civil_batch tests check for every day in range.
+//
+// Like simd_bytes.hpp, the AVX2 and SSE4.1 versions are compiled with a
+// target attribute and from_time_t() picks one at runtime, so nothing
+// needs -mavx2. The individual versions are public for time_bench and the
+// tests.
+
+// boost::gregorian's range, 1400-01-01 00:00:00 to 9999-12-31 23:59:59.
+// The SIMD versions need every input in it; from_time_t_scalar() works for
+// any time_t whose year fits in an int.
+const std::int64_t min_time = -17987443200LL;
+const std::int64_t max_time = 253402300799LL;
+
+// Caller owned arrays of at least n entries each
+struct columns {
+  std::int32_t* year;
+  std::int32_t* month;    // 1-12
+  std::int32_t* day;      // 1-31
+  std::int32_t* hour;
+  std::int32_t* minute;
+  std::int32_t* second;
+};
+
+namespace detail {
+
+// Day 0 is 0000-03-01, so that leap days come last in a year and the
+// years are non-negative for everything boost::gregorian handles
+const std::int32_t epoch_shift = 719468;   // 1970-01-01 - 0000-03-01
+
+} // namespace detail
+
+inline void
+from_time_t_scalar(const std::int64_t* t, const std::size_t n, const columns& out) {
+  for (std::size_t i = 0; i < n; ++i) {
+    // Floor division, for times before 1970
+    std::int64_t days = t[i] / 86400;
+    std::int64_t sod = t[i] - days * 86400;
+    const std::int64_t neg = sod < 0;
+    days -= neg;
+    sod += neg * 86400;
+
+    const std::int64_t z = days + detail::epoch_shift;
+    const std::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const std::int64_t doe = z - era * 146097;                                  // [0, 146096]
+    const std::int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;  // [0, 399]
+    const std::int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);             // [0, 365]
+    const std::int64_t mp = (5 * doy + 2) / 153;                                 // [0, 11], March is 0
+    const std::int64_t m = mp + 3 - 12 * (mp >= 10);
+
+    out.year[i] = static_cast<std::int32_t>(yoe + era * 400 + (m <= 2));
+    out.month[i] = static_cast<std::int32_t>(m);
+    out.day[i] = static_cast<std::int32_t>(doy - (153 * mp + 2) / 5 + 1);
+    out.hour[i] = static_cast<std::int32_t>(sod / 3600);
+    out.minute[i] = static_cast<std::int32_t>(sod / 60 % 60);
+    out.second[i] = static_cast<std::int32_t>(sod % 60);
+  }
+}
+
+#if CIVIL_BATCH_X86
+
+// x / c for 0 <= x < 2^24, see the top of the file
+# define CIVIL_BATCH_DIV(W, x, c) \
+  _mm##W##_cvttps_epi32(_mm##W##_div_ps(_mm##W##_cvtepi32_ps(x), _mm##W##_set1_ps(c)))
+
+// Four time_ts to days since 1970 and seconds of the day. |t| < 2^51
+// converts to double exactly by adding it to 1.5 * 2^52's bit pattern.
+__attribute__((target("sse4.1"))) inline void
+split_sse41(const std::int64_t* t, __m128i& days, __m128i& sod) {
+  const __m128i magic_i = _mm_set1_epi64x(0x4338000000000000LL);
+  const __m128d magic_d = _mm_set1_pd(6755399441055744.0);
+  const __m128d spd = _mm_set1_pd(86400.0);
+  __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t));
+  __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t + 2));
+  __m128d tlo = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(lo, magic_i)), magic_d);
+  __m128d thi = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(hi, magic_i)), magic_d);
+  __m128d dlo = _mm_floor_pd(_mm_div_pd(tlo, spd));
+  __m128d dhi = _mm_floor_pd(_mm_div_pd(thi, spd));
+  __m128d slo = _mm_sub_pd(tlo, _mm_mul_pd(dlo, spd));
+  __m128d shi = _mm_sub_pd(thi, _mm_mul_pd(dhi, spd));
+  days = _mm_unpacklo_epi64(_mm_cvttpd_epi32(dlo), _mm_cvttpd_epi32(dhi));
+  sod = _mm_unpacklo_epi64(_mm_cvttpd_epi32(slo), _mm_cvttpd_epi32(shi));
+}
+
+__attribute__((target("sse4.1"))) inline void
+from_time_t_sse41(const std::int64_t* t, const std::size_t n, const columns& out) {
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i days, sod;
+    split_sse41(t + i, days, sod);
+
+    const __m128i z = _mm_add_epi32(days, _mm_set1_epi32(detail::epoch_shift));
+    const __m128i era = CIVIL_BATCH_DIV(, z, 146097.0f);
+    const __m128i doe = _mm_sub_epi32(z, _mm_mullo_epi32(era, _mm_set1_epi32(146097)));
+    __m128i yoe = _mm_sub_epi32(doe, CIVIL_BATCH_DIV(, doe, 1460.0f));
+    yoe = _mm_add_epi32(yoe, CIVIL_BATCH_DIV(, doe, 36524.0f));
+    yoe = _mm_sub_epi32(yoe, CIVIL_BATCH_DIV(, doe, 146096.0f));
+    yoe = CIVIL_BATCH_DIV(, yoe, 365.0f);
+    __m128i doy = _mm_add_epi32(_mm_mullo_epi32(yoe, _mm_set1_epi32(365)), _mm_srli_epi32(yoe, 2));
+    doy = _mm_sub_epi32(doe, _mm_sub_epi32(doy, CIVIL_BATCH_DIV(, yoe, 100.0f)));
+    const __m128i mp = CIVIL_BATCH_DIV(, _mm_add_epi32(_mm_mullo_epi32(doy, _mm_set1_epi32(5)), _mm_set1_epi32(2)), 153.0f);
+    const __m128i d = _mm_sub_epi32(
+      _mm_add_epi32(doy, _mm_set1_epi32(1)),
+      CIVIL_BATCH_DIV(, _mm_add_epi32(_mm_mullo_epi32(mp, _mm_set1_epi32(153)), _mm_set1_epi32(2)), 5.0f));
+    const __m128i m = _mm_sub_epi32(_mm_add_epi32(mp, _mm_set1_epi32(3)),
+                                    _mm_and_si128(_mm_cmpgt_epi32(mp, _mm_set1_epi32(9)), _mm_set1_epi32(12)));
+    // Comparisons are -1 for true
+    const __m128i y = _mm_sub_epi32(_mm_add_epi32(yoe, _mm_mullo_epi32(era, _mm_set1_epi32(400))),
+                                    _mm_cmplt_epi32(m, _mm_set1_epi32(3)));
+
+    const __m128i h = CIVIL_BATCH_DIV(, sod, 3600.0f);
+    const __m128i mins = CIVIL_BATCH_DIV(, sod, 60.0f);
+    const __m128i min = _mm_sub_epi32(mins, _mm_mullo_epi32(h, _mm_set1_epi32(60)));
+    const __m128i s = _mm_sub_epi32(sod, _mm_mullo_epi32(mins, _mm_set1_epi32(60)));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out.year + i), y);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out.month + i), m);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out.day + i), d);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out.hour + i), h);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out.minute + i), min);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out.second + i), s);
+  }
+  const columns rest = { out.year + i, out.month + i, out.day + i, out.hour + i, out.minute + i, out.second + i };
+  from_time_t_scalar(t + i, n - i, rest);
+}
+
+// Same as the SSE4.1 version with eight lanes, and four time_ts per
+// double vector
+__attribute__((target("avx2"))) inline __m128i
+split_days_avx2(const std::int64_t* t, __m128i& sod) {
+  const __m256i magic_i = _mm256_set1_epi64x(0x4338000000000000LL);
+  const __m256d magic_d = _mm256_set1_pd(6755399441055744.0);
+  const __m256d spd = _mm256_set1_pd(86400.0);
+  const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t));
+  const __m256d td = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(v, magic_i)), magic_d);
+  const __m256d dd = _mm256_floor_pd(_mm256_div_pd(td, spd));
+  sod = _mm256_cvttpd_epi32(_mm256_sub_pd(td, _mm256_mul_pd(dd, spd)));
+  return _mm256_cvttpd_epi32(dd);
+}
+
+__attribute__((target("avx2"))) inline void
+from_time_t_avx2(const std::int64_t* t, const std::size_t n, const columns& out) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i sod_lo, sod_hi;
+    const __m128i days_lo = split_days_avx2(t + i, sod_lo);
+    const __m128i days_hi = split_days_avx2(t + i + 4, sod_hi);
+    const __m256i days = _mm256_inserti128_si256(_mm256_castsi128_si256(days_lo), days_hi, 1);
+    const __m256i sod = _mm256_inserti128_si256(_mm256_castsi128_si256(sod_lo), sod_hi, 1);
+
+    const __m256i z = _mm256_add_epi32(days, _mm256_set1_epi32(detail::epoch_shift));
+    const __m256i era = CIVIL_BATCH_DIV(256, z, 146097.0f);
+    const __m256i doe = _mm256_sub_epi32(z, _mm256_mullo_epi32(era, _mm256_set1_epi32(146097)));
+    __m256i yoe = _mm256_sub_epi32(doe, CIVIL_BATCH_DIV(256, doe, 1460.0f));
+    yoe = _mm256_add_epi32(yoe, CIVIL_BATCH_DIV(256, doe, 36524.0f));
+    yoe = _mm256_sub_epi32(yoe, CIVIL_BATCH_DIV(256, doe, 146096.0f));
+    yoe = CIVIL_BATCH_DIV(256, yoe, 365.0f);
+    __m256i doy = _mm256_add_epi32(_mm256_mullo_epi32(yoe, _mm256_set1_epi32(365)), _mm256_srli_epi32(yoe, 2));
+    doy = _mm256_sub_epi32(doe, _mm256_sub_epi32(doy, CIVIL_BATCH_DIV(256, yoe, 100.0f)));
+    const __m256i mp = CIVIL_BATCH_DIV(
+      256, _mm256_add_epi32(_mm256_mullo_epi32(doy, _mm256_set1_epi32(5)), _mm256_set1_epi32(2)), 153.0f);
+    const __m256i d = _mm256_sub_epi32(
+      _mm256_add_epi32(doy, _mm256_set1_epi32(1)),
+      CIVIL_BATCH_DIV(256, _mm256_add_epi32(_mm256_mullo_epi32(mp, _mm256_set1_epi32(153)), _mm256_set1_epi32(2)), 5.0f));
+    const __m256i m = _mm256_sub_epi32(
+      _mm256_add_epi32(mp, _mm256_set1_epi32(3)),
+      _mm256_and_si256(_mm256_cmpgt_epi32(mp, _mm256_set1_epi32(9)), _mm256_set1_epi32(12)));
+    const __m256i y = _mm256_add_epi32(
+      _mm256_add_epi32(yoe, _mm256_mullo_epi32(era, _mm256_set1_epi32(400))),
+      _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(3), m), _mm256_set1_epi32(1)));
+
+    const __m256i h = CIVIL_BATCH_DIV(256, sod, 3600.0f);
+    const __m256i mins = CIVIL_BATCH_DIV(256, sod, 60.0f);
+    const __m256i min = _mm256_sub_epi32(mins, _mm256_mullo_epi32(h, _mm256_set1_epi32(60)));
+    const __m256i s = _mm256_sub_epi32(sod, _mm256_mullo_epi32(mins, _mm256_set1_epi32(60)));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.year + i), y);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.month + i), m);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.day + i), d);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.hour + i), h);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.minute + i), min);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.second + i), s);
+  }
+  const columns rest = { out.year + i, out.month + i, out.day + i, out.hour + i, out.minute + i, out.second + i };
+  from_time_t_scalar(t + i, n - i, rest);
+}
+
+# undef CIVIL_BATCH_DIV
+
+#endif // CIVIL_BATCH_X86
+
+enum isa { scalar, sse41, avx2 };
+
+// The widest version this CPU runs
+inline isa
+best_isa() {
+#if CIVIL_BATCH_X86
+  static const isa best = __builtin_cpu_supports("avx2") ? avx2
+                        : __builtin_cpu_supports("sse4.1") ? sse41 : scalar;
+  return best;
+#else
+  return scalar;
+#endif
+}
+
+inline const char*
+isa_name(const isa i) {
+  static const char* const names[] = { "scalar", "sse4.1", "avx2" };
+  return names[i];
+}
+
+// Converts t[0..n) in to out's columns with the given version, which the
+// CPU has to support
+inline void
+from_time_t(const std::int64_t* t, const std::size_t n, const columns& out, const isa with) {
+  switch (with) {
+#if CIVIL_BATCH_X86
+  case avx2: from_time_t_avx2(t, n, out); return;
+  case sse41: from_time_t_sse41(t, n, out); return;
+#endif
+  default: from_time_t_scalar(t, n, out); return;
+  }
+}
+
+// Every t[i] has to be within [min_time, max_time]
+inline void
+from_time_t(const std::int64_t* t, const std::size_t n, const columns& out) {
+  from_time_t(t, n, out, best_isa());
+}
+
+} // namespace civil_batch
+
+#endif // CIVIL_BATCH_HPP
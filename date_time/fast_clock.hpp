@@ -0,0 +1,288 @@
+#ifndef FAST_CLOCK_HPP
+#define FAST_CLOCK_HPP
+
+#include <time.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <cpuid.h>
+# include <x86intrin.h>
+# define FAST_CLOCK_HAVE_TSC 1
+#else
+# define FAST_CLOCK_HAVE_TSC 0
+#endif
+
+#include "boost/date_time/gregorian/gregorian_types.hpp"
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+
+// Timestamps for hot paths. microsec_clock<ptime>::universal_time() makes a
+// system call (or at best a vDSO call) and then breaks the result down in
+// to a calendar date and time of day, every time. fast_clock::now() is a
+// single rdtsc and returns raw ticks; turning ticks in to a ptime, or in to
+// nanoseconds since the epoch, is left until someone actually wants one:
+//
+//   const fast_clock& clk = fast_clock::instance();
+//   fast_clock::tick_type t = clk.now();          // ~10ns
+//   ...
+//   boost::posix_time::ptime pt = clk.to_ptime(t);
+//
+// Tick sources, best first:
+//
+//   tsc              The invariant TSC (constant rate, keeps counting in
+//                    deep C-states), calibrated against CLOCK_REALTIME.
+//   monotonic_raw    clock_gettime(CLOCK_MONOTONIC_RAW) in ns, also
+//                    calibrated, since it isn't slewed by NTP and
+//                    CLOCK_REALTIME is.
+//   realtime_coarse  clock_gettime(CLOCK_REALTIME_COARSE), already wall
+//                    clock ns but only as fine as the kernel tick (1-4ms).
+//
+// A fast_clock uses the first one of those, starting at the one it was
+// asked for, that works here.
+//
+// Calibration brackets a CLOCK_REALTIME read between two tick reads at the
+// start and at the end of a short window and fits a straight line through
+// the two points. The TSC and the NTP disciplined wall clock then drift
+// apart by however far off the TSC's nominal rate is, typically a few ppm;
+// recalibrate() re-anchors the line to the wall clock (and re-measures the
+// rate) whenever that matters, e.g. from a once a minute timer.
+class fast_clock {
+public:
+  enum source_type { tsc, monotonic_raw, realtime_coarse };
+  typedef std::uint64_t tick_type;
+
+  // How long calibration watches the ticks go by. Longer is more accurate:
+  // the error in the rate is about the error of one wall clock read (well
+  // under 1us) over this.
+  static const long default_window_us = 10000;
+
+  explicit fast_clock(source_type preferred = tsc, long window_us = default_window_us)
+    : source_(pick(preferred)), window_us_(window_us), seq_(0) {
+    recalibrate();
+  }
+  fast_clock(const fast_clock&) = delete;
+  fast_clock& operator=(const fast_clock&) = delete;
+
+  // Shared clock with the default source and window, calibrated on first
+  // use. Not const so that whoever owns the once a minute timer can
+  // instance().recalibrate() it.
+  static fast_clock& instance() {
+    static fast_clock clk;
+    return clk;
+  }
+
+  source_type source() const { return source_; }
+
+  static const char* source_name(source_type s) {
+    static const char* const names[] = { "tsc", "monotonic_raw", "realtime_coarse" };
+    return names[s];
+  }
+
+  tick_type now() const {
+    switch (source_) {
+#if FAST_CLOCK_HAVE_TSC
+    case tsc:
+      return __rdtsc();
+#endif
+    case monotonic_raw:
+      return gettime_ns(raw_clock_id());
+    default:
+      return gettime_ns(coarse_clock_id());
+    }
+  }
+
+  // Nanoseconds since 1970-01-01 00:00:00 UTC
+  std::int64_t unix_ns(tick_type t) const {
+    const line l = load_line();
+    // Ticks before the anchor (taken before a recalibrate()) go backwards
+    // from it
+    if (t >= l.tick)
+      return l.wall_ns + static_cast<std::int64_t>(scale(t - l.tick, l.mult));
+    return l.wall_ns - static_cast<std::int64_t>(scale(l.tick - t, l.mult));
+  }
+
+  boost::posix_time::ptime to_ptime(tick_type t) const {
+    static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return epoch + boost::posix_time::microseconds(floor_div(unix_ns(t), 1000));
+  }
+
+  // Drop-in for microsec_clock<ptime>::universal_time()
+  boost::posix_time::ptime universal_time() const { return to_ptime(now()); }
+
+  // Nanoseconds from a to b, without involving the wall clock
+  std::int64_t ns_between(tick_type a, tick_type b) const {
+    const line l = load_line();
+    return b >= a ? static_cast<std::int64_t>(scale(b - a, l.mult))
+                  : -static_cast<std::int64_t>(scale(a - b, l.mult));
+  }
+
+  // Measures the tick rate again over the calibration window and anchors
+  // it to the wall clock as of now. Safe to call while other threads use
+  // the clock: they see either the old line or the new one, so readings
+  // step by whatever drift built up since the last time.
+  void recalibrate() {
+    line l;
+    if (source_ == realtime_coarse) {
+      // The ticks are already wall clock ns
+      l.tick = 0;
+      l.wall_ns = 0;
+      l.mult = std::uint64_t(1) << 32;
+    } else {
+      const sample a = take_sample();
+      sleep_us(window_us_);
+      const sample b = take_sample();
+      l.tick = b.tick;
+      l.wall_ns = b.wall_ns;
+      l.mult = b.tick > a.tick
+        ? static_cast<std::uint64_t>(((unsigned __int128)(b.wall_ns - a.wall_ns) << 32) / (b.tick - a.tick))
+        : std::uint64_t(1) << 32;
+    }
+    store_line(l);
+  }
+
+  // The TSC ticks at a constant rate regardless of P- and C-states
+  static bool has_invariant_tsc() {
+#if FAST_CLOCK_HAVE_TSC
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+      return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+  }
+
+private:
+  // wall_ns = line.wall_ns + (tick - line.tick) * mult / 2^32
+  struct line {
+    tick_type tick;
+    std::int64_t wall_ns;
+    std::uint64_t mult;
+  };
+
+  // A line readers load without a lock, as relaxed atomic words, see seq_
+  struct line_slot {
+    std::atomic<tick_type> tick;
+    std::atomic<std::int64_t> wall_ns;
+    std::atomic<std::uint64_t> mult;
+  };
+
+  struct sample {
+    tick_type tick;
+    std::int64_t wall_ns;
+  };
+
+  static source_type pick(source_type preferred) {
+    if (preferred == tsc && has_invariant_tsc())
+      return tsc;
+    if (preferred != realtime_coarse) {
+      struct timespec ts;
+      if (::clock_gettime(raw_clock_id(), &ts) == 0)
+        return monotonic_raw;
+    }
+    return realtime_coarse;
+  }
+
+  static clockid_t raw_clock_id() {
+#ifdef CLOCK_MONOTONIC_RAW
+    return CLOCK_MONOTONIC_RAW;
+#else
+    return CLOCK_MONOTONIC;
+#endif
+  }
+
+  static clockid_t coarse_clock_id() {
+#ifdef CLOCK_REALTIME_COARSE
+    return CLOCK_REALTIME_COARSE;
+#else
+    return CLOCK_REALTIME;
+#endif
+  }
+
+  static std::int64_t gettime_ns(clockid_t id) {
+    struct timespec ts;
+    ::clock_gettime(id, &ts);
+    return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  static std::uint64_t scale(std::uint64_t ticks, std::uint64_t mult) {
+    return static_cast<std::uint64_t>(((unsigned __int128)ticks * mult) >> 32);
+  }
+
+  static std::int64_t floor_div(std::int64_t a, std::int64_t b) {
+    return a / b - (a % b < 0 ? 1 : 0);
+  }
+
+  // Sleeps for us, less if nanosleep() fails for any reason other than a
+  // signal; calibration just gets a shorter window then.
+  static void sleep_us(long us) {
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    while (::nanosleep(&ts, &ts) != 0 && errno == EINTR)
+      ;
+  }
+
+  // Copies out the current line, and copies again if seq_ moved on in the
+  // meantime, since a second recalibrate() may have reused its slot
+  line load_line() const {
+    unsigned seq0, seq1;
+    line l;
+    do {
+      seq0 = seq_.load(std::memory_order_acquire);
+      const line_slot& s = slots_[seq0 & 1];
+      l.tick = s.tick.load(std::memory_order_relaxed);
+      l.wall_ns = s.wall_ns.load(std::memory_order_relaxed);
+      l.mult = s.mult.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      seq1 = seq_.load(std::memory_order_relaxed);
+    } while (seq0 != seq1);
+    return l;
+  }
+
+  // Writes l to the slot readers aren't using and then points them at it
+  void store_line(const line& l) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    const unsigned seq = seq_.load(std::memory_order_relaxed);
+    // Orders the previous store_line()'s seq_ before this one's slot
+    // writes, so a reader that sees those also sees seq_ move on
+    std::atomic_thread_fence(std::memory_order_release);
+    line_slot& s = slots_[(seq + 1) & 1];
+    s.tick.store(l.tick, std::memory_order_relaxed);
+    s.wall_ns.store(l.wall_ns, std::memory_order_relaxed);
+    s.mult.store(l.mult, std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_release);
+  }
+
+  // The wall clock read that's bracketed most tightly by two tick reads,
+  // paired with the tick half way between them
+  sample take_sample() const {
+    sample best = { 0, 0 };
+    tick_type best_gap = ~tick_type(0);
+    for (int i = 0; i < 16; ++i) {
+      const tick_type t0 = now();
+      const std::int64_t wall = gettime_ns(CLOCK_REALTIME);
+      const tick_type t1 = now();
+      if (t1 >= t0 && t1 - t0 < best_gap) {
+        best_gap = t1 - t0;
+        best.tick = t0 + (t1 - t0) / 2;
+        best.wall_ns = wall;
+      }
+    }
+    return best;
+  }
+
+  const source_type source_;
+  const long window_us_;
+  // Sequence lock over two slots: seq_ counts recalibrations and the
+  // current line is in slots_[seq_ & 1]. recalibrate() fills in the other
+  // slot before bumping seq_, so readers only retry when the slot they
+  // were reading gets reused.
+  std::atomic<unsigned> seq_;
+  line_slot slots_[2];
+  std::mutex mtx_;   // Serializes recalibrate()s
+};
+
+#endif // FAST_CLOCK_HPP
@@ -0,0 +1,269 @@
+#ifndef ISO8601_HPP
+#define ISO8601_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "boost/date_time/gregorian/gregorian_types.hpp"
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+
+namespace iso8601 {
+
+// ptime to and from RFC 3339 text, "2011-07-22T23:11:13.123456Z", without
+// boost::format, iostreams, locales or a single allocation: the formatter
+// writes in to the caller's buffer and the parser reads from one.
+//
+// Both remember the last date they saw. Consecutive timestamps in the same
+// second only rewrite the fraction, and in the same day only the time of
+// day, so formatting a log's worth of timestamps never breaks a day
+// number down in to a year, month and day more than once a day. The parser
+// likewise skips validating and converting the date when it's the same
+// text as last time. Neither is thread safe; give each thread its own.
+//
+// Special values (not_a_date_time, +/-infinity) aren't timestamps and
+// don't format; see formatter::format().
+
+// Longest thing format() writes: "YYYY-MM-DDTHH:MM:SS.fffffffffZ"
+const std::size_t max_length = 30;
+
+namespace detail {
+
+// "00" through "99"
+inline const char* digit_pairs() {
+  static const char pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  return pairs;
+}
+
+inline void put2(char* p, unsigned v) { std::memcpy(p, digit_pairs() + 2 * v, 2); }
+
+// Reads n digits at p in to v, false if any of them isn't one
+inline bool get_digits(const char* p, std::size_t n, unsigned& v) {
+  v = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    const unsigned d = static_cast<unsigned char>(p[i]) - '0';
+    if (d > 9)
+      return false;
+    v = v * 10 + d;
+  }
+  return true;
+}
+
+} // namespace detail
+
+class formatter {
+public:
+  // frac_digits (0-9) is how many digits of the fractional second to
+  // write; 0 leaves out the '.' too. ptime only keeps microseconds by
+  // default, so digits past 6 are zeros.
+  explicit formatter(unsigned frac_digits = 6)
+    : frac_digits_(frac_digits > 9 ? 9 : frac_digits), day_(0), second_(boost::posix_time::not_a_date_time) {}
+
+  // What every format() writes
+  std::size_t length() const { return 20 + (frac_digits_ ? frac_digits_ + 1 : 0); }
+
+  // Writes t to buf, which has room for length() chars (max_length always
+  // does), and returns length(). Doesn't NUL terminate. Returns 0 and
+  // writes nothing for special values.
+  std::size_t format(const boost::posix_time::ptime& t, char* buf) {
+    if (t.is_special())
+      return 0;
+    const std::int64_t tps = boost::posix_time::time_duration::ticks_per_second();
+
+    // Same second as last time is a subtraction, anything else breaks t
+    // down and rewrites the cached "YYYY-MM-DDTHH:MM:SS" (19 chars) from
+    // the time of day on, or from the date on if that changed too
+    std::int64_t frac = second_.is_special() ? -1 : (t - second_).ticks();
+    if (frac < 0 || frac >= tps) {
+      const boost::posix_time::time_duration tod = t.time_of_day();
+      const std::int64_t sod = tod.ticks() / tps;
+      const boost::gregorian::date d = t.date();
+      if (d.day_number() != day_) {
+        const boost::gregorian::date::ymd_type ymd = d.year_month_day();
+        detail::put2(prefix_, ymd.year / 100);
+        detail::put2(prefix_ + 2, ymd.year % 100);
+        prefix_[4] = '-';
+        detail::put2(prefix_ + 5, ymd.month);
+        prefix_[7] = '-';
+        detail::put2(prefix_ + 8, ymd.day);
+        prefix_[10] = 'T';
+        day_ = d.day_number();
+      }
+      detail::put2(prefix_ + 11, static_cast<unsigned>(sod / 3600));
+      prefix_[13] = ':';
+      detail::put2(prefix_ + 14, static_cast<unsigned>(sod / 60 % 60));
+      prefix_[16] = ':';
+      detail::put2(prefix_ + 17, static_cast<unsigned>(sod % 60));
+      frac = tod.ticks() - sod * tps;
+      second_ = t - boost::posix_time::time_duration(0, 0, 0, frac);
+    }
+    std::memcpy(buf, prefix_, 19);
+
+    char* p = buf + 19;
+    if (frac_digits_) {
+      // The fraction in nanoseconds, then the first frac_digits_ of them
+      // right to left
+      std::uint64_t ns = static_cast<std::uint64_t>(frac) * 1000000000 / tps;
+      for (unsigned i = frac_digits_; i < 9; ++i)
+        ns /= 10;
+      *p++ = '.';
+      for (unsigned i = frac_digits_; i > 0; --i) {
+        p[i - 1] = static_cast<char>('0' + ns % 10);
+        ns /= 10;
+      }
+      p += frac_digits_;
+    }
+    *p++ = 'Z';
+    return static_cast<std::size_t>(p - buf);
+  }
+
+  // Formats t[0..n) to out, one every stride (>= length()) chars, with
+  // whatever is left of each stride untouched. A special value's slot is
+  // filled with length() spaces so the columns stay lined up. Returns how
+  // many weren't special.
+  std::size_t format(const boost::posix_time::ptime* t, std::size_t n, char* out, std::size_t stride) {
+    std::size_t formatted = 0;
+    for (std::size_t i = 0; i < n; ++i, out += stride) {
+      if (format(t[i], out))
+        ++formatted;
+      else
+        std::memset(out, ' ', length());
+    }
+    return formatted;
+  }
+
+private:
+  const unsigned frac_digits_;
+  std::uint32_t day_;                    // Day number prefix_ has the date of
+  boost::posix_time::ptime second_;      // Start of the second prefix_ has, or not_a_date_time
+  char prefix_[19];
+};
+
+// One-off formatter::format()
+inline std::size_t
+format(const boost::posix_time::ptime& t, char* buf, unsigned frac_digits = 6) {
+  formatter f(frac_digits);
+  return f.format(t, buf);
+}
+
+
+// Reads RFC 3339 timestamps and the ISO 8601 extended format around them:
+//
+//   YYYY-MM-DD('T'|'t'|' ')HH:MM:SS[.f...][('Z'|'z'|+HH:MM|-HH:MM)]
+//
+// with any number of fraction digits (past the clock's resolution they're
+// truncated) and no zone meaning UTC. The result is in UTC. Years are
+// limited to boost::gregorian's 1400-9999, both as written and once in
+// UTC, and leap seconds (:60) are rejected because ptime can't hold them.
+class parser {
+public:
+  parser() : have_date_(false), date_(boost::gregorian::not_a_date_time) {}
+
+  // Parses all of s[0..n) in to out. Returns false, and leaves out alone,
+  // if it isn't a valid timestamp.
+  bool parse(const char* s, std::size_t n, boost::posix_time::ptime& out) {
+    if (n < 19 || s[4] != '-' || s[7] != '-' || s[13] != ':' || s[16] != ':')
+      return false;
+    if (s[10] != 'T' && s[10] != 't' && s[10] != ' ')
+      return false;
+
+    if (!have_date_ || std::memcmp(s, date_text_, 10) != 0) {
+      unsigned y, m, d;
+      if (!detail::get_digits(s, 4, y) || !detail::get_digits(s + 5, 2, m) || !detail::get_digits(s + 8, 2, d))
+        return false;
+      if (y < 1400 || y > 9999 || m < 1 || m > 12 || d < 1 ||
+          d > boost::gregorian::gregorian_calendar::end_of_month_day(y, m))
+        return false;
+      date_ = boost::gregorian::date(y, m, d);
+      std::memcpy(date_text_, s, 10);
+      have_date_ = true;
+    }
+
+    unsigned hh, mm, ss;
+    if (!detail::get_digits(s + 11, 2, hh) || !detail::get_digits(s + 14, 2, mm) ||
+        !detail::get_digits(s + 17, 2, ss) || hh > 23 || mm > 59 || ss > 59)
+      return false;
+
+    const std::int64_t tps = boost::posix_time::time_duration::ticks_per_second();
+    std::int64_t ticks = (std::int64_t(hh) * 3600 + mm * 60 + ss) * tps;
+    std::size_t i = 19;
+    if (i < n && s[i] == '.') {
+      // Digits past the resolution still have to be digits
+      std::int64_t frac = 0, scale = tps;
+      const std::size_t start = ++i;
+      for (; i < n && static_cast<unsigned>(s[i] - '0') <= 9; ++i) {
+        if (scale >= 10) {
+          scale /= 10;
+          frac += (s[i] - '0') * scale;
+        }
+      }
+      if (i == start)
+        return false;
+      ticks += frac;
+    }
+
+    std::int64_t offset_s = 0;
+    if (i < n && (s[i] == 'Z' || s[i] == 'z')) {
+      ++i;
+    } else if (i < n && (s[i] == '+' || s[i] == '-')) {
+      unsigned oh, om;
+      if (n - i < 6 || s[i + 3] != ':' || !detail::get_digits(s + i + 1, 2, oh) ||
+          !detail::get_digits(s + i + 4, 2, om) || oh > 23 || om > 59)
+        return false;
+      offset_s = (s[i] == '+' ? 1 : -1) * (std::int64_t(oh) * 3600 + om * 60);
+      i += 6;
+    }
+    if (i != n)
+      return false;
+
+    // The offset can push the time in to the day before or after, which
+    // isn't one ptime can hold if date_ is the first or last day it can
+    const std::int64_t utc_ticks = ticks - offset_s * tps;
+    static const boost::gregorian::date first(boost::date_time::min_date_time);
+    static const boost::gregorian::date last(boost::date_time::max_date_time);
+    if ((utc_ticks < 0 && date_ == first) || (utc_ticks >= 86400 * tps && date_ == last))
+      return false;
+
+    out = boost::posix_time::ptime(date_, boost::posix_time::time_duration(0, 0, 0, utc_ticks));
+    return true;
+  }
+
+  bool parse(const char* s, boost::posix_time::ptime& out) { return parse(s, std::strlen(s), out); }
+
+  // Parses n timestamps from text, one every stride chars, each one its
+  // whole stride less any trailing ' ', '\n' or NUL padding
+  // (formatter::format()'s batch output, or one per line). out[i] is
+  // not_a_date_time for any that don't parse. Returns how many did.
+  std::size_t parse(const char* text, std::size_t n, std::size_t stride, boost::posix_time::ptime* out) {
+    std::size_t parsed = 0;
+    for (std::size_t i = 0; i < n; ++i, text += stride) {
+      std::size_t len = stride;
+      while (len > 0 && (text[len - 1] == ' ' || text[len - 1] == '\n' || text[len - 1] == '\0'))
+        --len;
+      if (parse(text, len, out[i]))
+        ++parsed;
+      else
+        out[i] = boost::posix_time::ptime(boost::posix_time::not_a_date_time);
+    }
+    return parsed;
+  }
+
+private:
+  bool have_date_;
+  char date_text_[10];                 // "YYYY-MM-DD" of date_
+  boost::gregorian::date date_;
+};
+
+// One-off parser::parse()
+inline bool
+parse(const char* s, std::size_t n, boost::posix_time::ptime& out) {
+  parser p;
+  return p.parse(s, n, out);
+}
+
+} // namespace iso8601
+
+#endif // ISO8601_HPP
@@ -0,0 +1,206 @@
+// Per-call cost of getting, converting, formatting and parsing timestamps,
+// boost::date_time's way vs. fast_clock.hpp's, civil_batch.hpp's and
+// iso8601.hpp's. Each case runs -n times in a tight loop and prints ns per
+// call (per timestamp for the batch versions, which go through -b
+// timestamps at a time); sink keeps the results from being optimized away.
+
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/date_time/microsec_time_clock.hpp"
+
+#include "civil_batch.hpp"
+#include "fast_clock.hpp"
+#include "iso8601.hpp"
+
+namespace {
+
+typedef std::chrono::steady_clock bench_clock;
+
+std::uint64_t sink = 0;
+
+template <typename F>
+void
+run(const char* name, unsigned long n, F f) {
+  const bench_clock::time_point t0 = bench_clock::now();
+  for (unsigned long i = 0; i < n; ++i)
+    sink += f(i);
+  const double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count();
+  std::cout << std::left << std::setw(40) << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(1) << ns / n << "\n";
+}
+
+void
+bench_clocks(unsigned long n) {
+  using ::boost::posix_time::ptime;
+  typedef ::boost::date_time::microsec_clock< ptime > msecc_t;
+  const fast_clock& clk = fast_clock::instance();
+
+  std::cout << "fast_clock source: " << fast_clock::source_name(clk.source()) << "\n";
+  run("microsec_clock::universal_time()", n, [](unsigned long) {
+    return msecc_t::universal_time().time_of_day().ticks();
+  });
+  run("clock_gettime(CLOCK_REALTIME)", n, [](unsigned long) {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    return std::uint64_t(ts.tv_nsec);
+  });
+  run("fast_clock::now()", n, [&clk](unsigned long) { return clk.now(); });
+  run("fast_clock::unix_ns(now())", n, [&clk](unsigned long) { return clk.unix_ns(clk.now()); });
+  run("fast_clock::universal_time()", n, [&clk](unsigned long) {
+    return clk.universal_time().time_of_day().ticks();
+  });
+}
+
+// Per-timestamp cost of time_t to year/month/day/hour/minute/second, in
+// batches of batch timestamps spread over 1970-2038
+void
+bench_civil(unsigned long n, std::size_t batch) {
+  std::vector<std::int64_t> t(batch);
+  std::uint64_t x = 88172645463325252ULL;
+  for (std::size_t i = 0; i < batch; ++i) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    t[i] = static_cast<std::int64_t>(x % 2147483648ULL);
+  }
+  std::vector<std::int32_t> cols(6 * batch);
+  const civil_batch::columns out = {
+    &cols[0], &cols[batch], &cols[2 * batch], &cols[3 * batch], &cols[4 * batch], &cols[5 * batch]
+  };
+
+  run("from_time_t(t) date + time_of_day", n, [&t, batch](unsigned long i) {
+    const ::boost::posix_time::ptime pt = ::boost::posix_time::from_time_t(t[i % batch]);
+    const ::boost::gregorian::date::ymd_type ymd = pt.date().year_month_day();
+    return std::uint64_t(ymd.year + ymd.month + ymd.day + pt.time_of_day().hours() +
+                         pt.time_of_day().minutes() + pt.time_of_day().seconds());
+  });
+  run("gmtime_r()", n, [&t, batch](unsigned long i) {
+    const std::time_t tt = t[i % batch];
+    struct tm tm;
+    ::gmtime_r(&tt, &tm);
+    return std::uint64_t(tm.tm_year + tm.tm_mon + tm.tm_mday + tm.tm_hour + tm.tm_min + tm.tm_sec);
+  });
+  // One call per batch, charged to the batch's timestamps
+  const unsigned long batches = (n + batch - 1) / batch;
+  for (int i = civil_batch::scalar; i <= civil_batch::best_isa(); ++i) {
+    const civil_batch::isa isa = static_cast<civil_batch::isa>(i);
+    const std::string name = std::string("civil_batch::from_time_t() ") + civil_batch::isa_name(isa);
+    const bench_clock::time_point t0 = bench_clock::now();
+    for (unsigned long b = 0; b < batches; ++b) {
+      civil_batch::from_time_t(&t[0], batch, out, isa);
+      sink += cols[b % cols.size()];
+    }
+    const double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count();
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::setw(12) << std::fixed << std::setprecision(1) << ns / (batches * batch) << "\n";
+  }
+}
+
+// ptime to text and back. "log" timestamps are 1ms apart, so most share a
+// second and nearly all a day with the one before; "spread" ones are a
+// random day and time each.
+void
+bench_iso8601(unsigned long n, std::size_t batch) {
+  using namespace ::boost::posix_time;
+  using ::boost::gregorian::date;
+
+  std::vector<ptime> log, spread;
+  std::uint64_t x = 88172645463325252ULL;
+  for (std::size_t i = 0; i < batch; ++i) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    log.push_back(ptime(date(2011, 7, 22), hours(12)) + microseconds(1000 * i + x % 1000));
+    spread.push_back(ptime(date(1970, 1, 1)) + microseconds(static_cast<std::int64_t>(x % 2147483648000000ULL)));
+  }
+  // time_from_string() wants a ' ' and no zone
+  std::vector<std::string> log_text(batch), log_boost_text(batch);
+  for (std::size_t i = 0; i < batch; ++i) {
+    log_boost_text[i] = to_iso_extended_string(log[i]);
+    log_text[i] = log_boost_text[i] + "Z";
+    log_boost_text[i][10] = ' ';
+  }
+
+  char buf[iso8601::max_length];
+  run("to_iso_extended_string() log", n, [&log, batch](unsigned long i) {
+    return std::uint64_t(to_iso_extended_string(log[i % batch]).size());
+  });
+  run("iso8601::format() spread", n, [&spread, &buf, batch](unsigned long i) {
+    return std::uint64_t(iso8601::format(spread[i % batch], buf) + buf[18]);
+  });
+  iso8601::formatter f;
+  run("iso8601::formatter log", n, [&log, &buf, &f, batch](unsigned long i) {
+    return std::uint64_t(f.format(log[i % batch], buf) + buf[18]);
+  });
+  std::vector<char> text(batch * f.length());
+  run("iso8601::formatter batch log", n, [&log, &text, &f, batch](unsigned long i) {
+    return std::uint64_t(i % batch == 0 ? f.format(&log[0], batch, &text[0], f.length()) + text[i % text.size()] : 0);
+  });
+
+  run("time_from_string() log", n, [&log_boost_text, batch](unsigned long i) {
+    return std::uint64_t(time_from_string(log_boost_text[i % batch]).time_of_day().ticks());
+  });
+  run("iso8601::parse() log", n, [&log_text, batch](unsigned long i) {
+    ptime t;
+    const std::string& s = log_text[i % batch];
+    return std::uint64_t(iso8601::parse(s.data(), s.size(), t) + t.time_of_day().ticks());
+  });
+  iso8601::parser p;
+  run("iso8601::parser log", n, [&log_text, &p, batch](unsigned long i) {
+    ptime t;
+    const std::string& s = log_text[i % batch];
+    return std::uint64_t(p.parse(s.data(), s.size(), t) + t.time_of_day().ticks());
+  });
+  std::vector<ptime> back(batch);
+  run("iso8601::parser batch log", n, [&text, &back, &p, &f, batch](unsigned long i) {
+    return std::uint64_t(i % batch == 0 ? p.parse(&text[0], batch, f.length(), &back[0]) : 0);
+  });
+}
+
+void
+usage() {
+  std::cerr << "time_bench [-n iterations] [-b batch]\n"
+            << "\t-n iterations\tCalls per case (default: 10000000)\n"
+            << "\t-b batch\tTimestamps per civil_batch call (default: 4096)\n";
+}
+
+} // anon namespace
+
+
+int
+main(const int argc, char* const argv[]) {
+  unsigned long n = 10000000;
+  std::size_t batch = 4096;
+
+  int ch;
+  while ((ch = ::getopt(argc, argv, "b:n:")) != -1) {
+    switch (ch) {
+    case 'b': batch = std::strtoul(optarg, nullptr, 10); break;
+    case 'n': n = std::strtoul(optarg, nullptr, 10); break;
+    default:
+      usage();
+      return EX_USAGE;
+    }
+  }
+  if (n == 0 || batch == 0) {
+    usage();
+    return EX_USAGE;
+  }
+
+  std::cout << std::left << std::setw(40) << "op" << std::right << std::setw(12) << "ns/call" << "\n";
+  bench_clocks(n);
+  bench_civil(n, batch);
+  bench_iso8601(n, batch);
+
+  if (sink == 0)
+    std::cout << "(nothing measured)\n";
+  return EX_OK;
+}
@@ -1,6 +1,11 @@
+#include <time.h>
+
+#include <cerrno>
+#include <cstdlib>
 #include <ctime>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include "boost/date_time/posix_time/posix_time_duration.hpp"
@@ -8,6 +13,10 @@
 #include "boost/date_time/gregorian/gregorian.hpp"
 #include "boost/format.hpp"
 
+#include "civil_batch.hpp"
+#include "fast_clock.hpp"
+#include "iso8601.hpp"
+
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MAIN
 #include <boost/test/unit_test.hpp>
@@ -81,3 +90,377 @@ BOOST_AUTO_TEST_CASE( epoc_date_duration ) {
   std::cout << format("days from epoc to time(1311376273): %1%")
       % day_diff.days() << std::endl;
 }
+
+
+
+namespace {
+
+// Sleeps for ms milliseconds
+void nap(long ms) {
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+  while (::nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+}
+
+// Checks that microsec_clock's reading lands between two of clk's, give or
+// take tolerance: bracketing it means a preemption between the reads can
+// only widen the window, not fail the test.
+void check_against_microsec_clock(const fast_clock& clk, const ::boost::posix_time::time_duration& tolerance) {
+  using ::boost::posix_time::ptime;
+  typedef ::boost::date_time::microsec_clock< ptime > msecc_t;
+
+  ptime before = clk.universal_time();
+  ptime t = msecc_t::universal_time();
+  ptime after = clk.universal_time();
+
+  BOOST_CHECK_LE(before, after);
+  BOOST_CHECK_LE(before - tolerance, t);
+  BOOST_CHECK_LE(t, after + tolerance);
+}
+
+} // anon namespace
+
+
+
+BOOST_AUTO_TEST_CASE( fast_clock_sources ) {
+  using ::boost::posix_time::milliseconds;
+
+  fast_clock tsc_clk(fast_clock::tsc);
+  fast_clock raw_clk(fast_clock::monotonic_raw);
+  fast_clock coarse_clk(fast_clock::realtime_coarse);
+
+  if (fast_clock::has_invariant_tsc())
+    BOOST_CHECK_EQUAL(tsc_clk.source(), fast_clock::tsc);
+  BOOST_CHECK_NE(raw_clk.source(), fast_clock::tsc);
+  BOOST_CHECK_EQUAL(coarse_clk.source(), fast_clock::realtime_coarse);
+
+  check_against_microsec_clock(tsc_clk, milliseconds(1));
+  check_against_microsec_clock(raw_clk, milliseconds(1));
+  // Only as fine as the kernel tick
+  check_against_microsec_clock(coarse_clk, milliseconds(20));
+  std::cout << format("fast_clock source: %1%")
+      % fast_clock::source_name(fast_clock::instance().source()) << std::endl;
+}
+
+
+
+BOOST_AUTO_TEST_CASE( fast_clock_drift ) {
+  using ::boost::posix_time::microseconds;
+  using ::boost::posix_time::milliseconds;
+
+  const fast_clock& clk = fast_clock::instance();
+
+  // Ticks never go backwards, and ns_between() agrees with unix_ns()
+  fast_clock::tick_type prev = clk.now();
+  for (int i = 0; i < 100000; ++i) {
+    fast_clock::tick_type t = clk.now();
+    BOOST_REQUIRE_LE(prev, t);
+    prev = t;
+  }
+  fast_clock::tick_type a = clk.now();
+  nap(5);
+  fast_clock::tick_type b = clk.now();
+  // Each side rounds down on its own
+  BOOST_CHECK_LE(std::abs(clk.ns_between(a, b) - (clk.unix_ns(b) - clk.unix_ns(a))), 1);
+  BOOST_CHECK_EQUAL(clk.ns_between(b, a), -clk.ns_between(a, b));
+  BOOST_CHECK_GE(clk.ns_between(a, b), 5000000);
+
+  // Stays within 500us of microsec_clock for a while, and within 100us
+  // after a recalibration
+  for (int i = 0; i < 20; ++i) {
+    nap(10);
+    check_against_microsec_clock(clk, microseconds(500));
+  }
+  fast_clock::instance().recalibrate();
+  check_against_microsec_clock(clk, microseconds(100));
+  fast_clock fresh(clk.source(), 2000);
+  nap(50);
+  fresh.recalibrate();
+  check_against_microsec_clock(fresh, microseconds(100));
+
+  // A tick from before the recalibration still converts, to before now
+  BOOST_CHECK_LT(fresh.to_ptime(a), fresh.universal_time() - milliseconds(50));
+}
+
+
+
+namespace {
+
+// The versions of civil_batch::from_time_t() this CPU can run
+std::vector<civil_batch::isa> supported_isas() {
+  std::vector<civil_batch::isa> isas;
+  for (int i = civil_batch::scalar; i <= civil_batch::best_isa(); ++i)
+    isas.push_back(static_cast<civil_batch::isa>(i));
+  return isas;
+}
+
+struct civil_columns {
+  explicit civil_columns(std::size_t n)
+    : year(n), month(n), day(n), hour(n), minute(n), second(n) {}
+
+  civil_batch::columns columns() {
+    civil_batch::columns c = { &year[0], &month[0], &day[0], &hour[0], &minute[0], &second[0] };
+    return c;
+  }
+
+  std::vector<boost::int32_t> year, month, day, hour, minute, second;
+};
+
+} // anon namespace
+
+
+
+BOOST_AUTO_TEST_CASE( civil_batch_known_values ) {
+  using namespace ::boost::posix_time;
+
+  const boost::int64_t t[] = { 0, 1311376273, -1, 951782400, 951868799, 4107542400LL,
+                               civil_batch::min_time, civil_batch::max_time, 1, 2, 3 };
+  const std::size_t n = sizeof(t) / sizeof(t[0]);
+  const std::vector<civil_batch::isa> isas = supported_isas();
+  for (std::size_t k = 0; k < isas.size(); ++k) {
+    civil_columns out(n);
+    civil_batch::from_time_t(t, n, out.columns(), isas[k]);
+    for (std::size_t i = 0; i < n; ++i) {
+      ptime pt = from_time_t(static_cast<std::time_t>(t[i]));
+      BOOST_CHECK_EQUAL(out.year[i], pt.date().year());
+      BOOST_CHECK_EQUAL(out.month[i], pt.date().month().as_number());
+      BOOST_CHECK_EQUAL(out.day[i], pt.date().day().as_number());
+      BOOST_CHECK_EQUAL(out.hour[i], pt.time_of_day().hours());
+      BOOST_CHECK_EQUAL(out.minute[i], pt.time_of_day().minutes());
+      BOOST_CHECK_EQUAL(out.second[i], pt.time_of_day().seconds());
+    }
+  }
+  std::cout << format("civil_batch: %1%") % civil_batch::isa_name(civil_batch::best_isa()) << std::endl;
+}
+
+
+
+// Every day boost::gregorian supports, at its first and last second and
+// one in between, against gregorian::date, in every version
+BOOST_AUTO_TEST_CASE( civil_batch_every_day ) {
+  using namespace ::boost::gregorian;
+
+  const boost::int64_t first_day = civil_batch::min_time / 86400;
+  const boost::int64_t last_day = civil_batch::max_time / 86400;
+  const boost::int64_t chunk_days = 1 << 16;
+  const std::vector<civil_batch::isa> isas = supported_isas();
+
+  std::vector<boost::int64_t> t;
+  std::vector<date::ymd_type> expect;
+  civil_columns out(3 * chunk_days);
+  date dt = date(1970, 1, 1) + days(static_cast<long>(first_day));
+  BOOST_REQUIRE_EQUAL(dt, date(1400, 1, 1));
+  std::size_t failures = 0;
+  for (boost::int64_t day0 = first_day; day0 <= last_day; day0 += chunk_days) {
+    t.clear();
+    expect.clear();
+    for (boost::int64_t d = day0; d < day0 + chunk_days && d <= last_day; ++d, dt += days(1)) {
+      t.push_back(d * 86400);
+      t.push_back(d * 86400 + (d * 7919 % 86400 + 86400) % 86400);
+      t.push_back(d * 86400 + 86399);
+      expect.push_back(dt.year_month_day());
+    }
+    for (std::size_t k = 0; k < isas.size(); ++k) {
+      civil_batch::from_time_t(&t[0], t.size(), out.columns(), isas[k]);
+      for (std::size_t i = 0; i < t.size(); ++i) {
+        const date::ymd_type& ymd = expect[i / 3];
+        const boost::int64_t sod = t[i] - (day0 + boost::int64_t(i / 3)) * 86400;
+        if (out.year[i] != ymd.year || out.month[i] != ymd.month || out.day[i] != ymd.day ||
+            out.hour[i] != sod / 3600 || out.minute[i] != sod / 60 % 60 || out.second[i] != sod % 60) {
+          if (++failures <= 10)
+            BOOST_ERROR(format("%1%: t=%2% gave %3%-%4%-%5% %6%:%7%:%8%, expected %9%")
+                        % civil_batch::isa_name(isas[k]) % t[i] % out.year[i] % out.month[i] % out.day[i]
+                        % out.hour[i] % out.minute[i] % out.second[i] % to_iso_extended_string(date(ymd)));
+        }
+      }
+    }
+  }
+  BOOST_CHECK_EQUAL(dt, date(9999, 12, 31) + days(1));
+  BOOST_CHECK_EQUAL(failures, 0u);
+}
+
+
+
+// Every second of a day, in every version
+BOOST_AUTO_TEST_CASE( civil_batch_every_second ) {
+  using namespace ::boost::posix_time;
+
+  const boost::int64_t day0 = 1311376273 / 86400 * 86400;
+  std::vector<boost::int64_t> t(86400);
+  for (std::size_t i = 0; i < t.size(); ++i)
+    t[i] = day0 + i;
+  const std::vector<civil_batch::isa> isas = supported_isas();
+  for (std::size_t k = 0; k < isas.size(); ++k) {
+    civil_columns out(t.size());
+    civil_batch::from_time_t(&t[0], t.size(), out.columns(), isas[k]);
+    std::size_t failures = 0;
+    for (std::size_t i = 0; i < t.size(); ++i) {
+      const time_duration td = seconds(static_cast<long>(i));
+      failures += out.year[i] != 2011 || out.month[i] != 7 || out.day[i] != 22 ||
+                  out.hour[i] != td.hours() || out.minute[i] != td.minutes() || out.second[i] != td.seconds();
+    }
+    BOOST_CHECK_EQUAL(failures, 0u);
+  }
+}
+
+
+
+namespace {
+
+// What iso8601::format() should make of t: to_iso_extended_string() leaves
+// out a zero fraction and the zone
+std::string expected_iso8601(const ::boost::posix_time::ptime& t) {
+  std::string s = ::boost::posix_time::to_iso_extended_string(t);
+  if (s.find('.') == std::string::npos)
+    s += ".000000";
+  return s + "Z";
+}
+
+} // anon namespace
+
+
+
+// Random times all over boost::gregorian's range, one-off and through one
+// formatter, against to_iso_extended_string() and back through the parser
+BOOST_AUTO_TEST_CASE( iso8601_round_trip ) {
+  using namespace ::boost::posix_time;
+  using ::boost::gregorian::date;
+
+  const ptime first(date(1400, 1, 1));
+  const boost::int64_t range_us = (ptime(date(9999, 12, 31), hours(24)) - first).total_microseconds();
+  iso8601::formatter f;
+  iso8601::parser p;
+  boost::uint64_t x = 88172645463325252ULL;
+  for (int i = 0; i < 100000; ++i) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    const ptime t = first + microseconds(static_cast<boost::int64_t>(x % range_us));
+    // Every so often a whole second, which to_iso_extended_string() writes
+    // without a fraction
+    const ptime u = i % 8 ? t : ptime(t.date(), seconds(t.time_of_day().total_seconds()));
+
+    char buf[iso8601::max_length];
+    const std::size_t n = iso8601::format(u, buf);
+    BOOST_REQUIRE_EQUAL(std::string(buf, n), expected_iso8601(u));
+    BOOST_REQUIRE_EQUAL(f.format(u, buf), n);
+    BOOST_REQUIRE_EQUAL(std::string(buf, n), expected_iso8601(u));
+
+    ptime back;
+    BOOST_REQUIRE(p.parse(buf, n, back));
+    BOOST_REQUIRE_EQUAL(back, u);
+    // time_from_string() takes the same thing with a ' ' and no zone
+    buf[10] = ' ';
+    BOOST_REQUIRE_EQUAL(time_from_string(std::string(buf, n - 1)), u);
+  }
+}
+
+
+
+// Walks across second and day boundaries so the formatter and parser use
+// and refresh what they cached, against fresh ones that can't
+BOOST_AUTO_TEST_CASE( iso8601_cached_prefix ) {
+  using namespace ::boost::posix_time;
+  using ::boost::gregorian::date;
+
+  const unsigned digits[] = { 0, 3, 6, 9 };
+  for (std::size_t k = 0; k < sizeof(digits) / sizeof(digits[0]); ++k) {
+    iso8601::formatter cached(digits[k]);
+    iso8601::parser p;
+    ptime t(date(2011, 12, 31), hours(23) + minutes(59) + seconds(58));
+    std::size_t failures = 0;
+    for (int i = 0; i < 20000; ++i, t += microseconds(317)) {
+      char a[iso8601::max_length], b[iso8601::max_length];
+      const std::size_t n = cached.format(t, a);
+      failures += n != cached.length() || iso8601::format(t, b, digits[k]) != n || std::memcmp(a, b, n) != 0;
+      ptime back;
+      failures += !p.parse(a, n, back);
+      // Truncated to the digits written
+      const boost::int64_t keep = digits[k] >= 6 ? 1 : digits[k] == 3 ? 1000 : 1000000;
+      failures += (back - ptime(date(2011, 12, 31))).total_microseconds() !=
+                  (t - ptime(date(2011, 12, 31))).total_microseconds() / keep * keep;
+    }
+    BOOST_CHECK_EQUAL(failures, 0u);
+    BOOST_CHECK_EQUAL(t.date(), date(2012, 1, 1));
+  }
+
+  char buf[iso8601::max_length];
+  BOOST_CHECK_EQUAL(iso8601::format(ptime(date(2011, 7, 22), seconds(83473) + microseconds(5)), buf, 9), 30u);
+  BOOST_CHECK_EQUAL(std::string(buf, 30), "2011-07-22T23:11:13.000005000Z");
+  BOOST_CHECK_EQUAL(iso8601::format(ptime(not_a_date_time), buf), 0u);
+  BOOST_CHECK_EQUAL(iso8601::format(ptime(pos_infin), buf), 0u);
+}
+
+
+
+BOOST_AUTO_TEST_CASE( iso8601_parse ) {
+  using namespace ::boost::posix_time;
+  using ::boost::gregorian::date;
+
+  const ptime friday(date(2011, 7, 22), hours(23) + minutes(11) + seconds(13));
+  const struct {
+    const char* text;
+    ptime expect;
+  } good[] = {
+    { "2011-07-22T23:11:13Z", friday },
+    { "2011-07-22t23:11:13z", friday },
+    { "2011-07-22 23:11:13", friday },
+    { "2011-07-22T23:11:13.5Z", friday + milliseconds(500) },
+    { "2011-07-22T23:11:13.123456789Z", friday + microseconds(123456) },
+    { "2011-07-23T04:41:13+05:30", friday },
+    { "2011-07-22T15:11:13.25-08:00", friday + milliseconds(250) },
+    { "2012-02-29T00:00:00Z", ptime(date(2012, 2, 29)) },
+    { "2000-02-29T00:00:00Z", ptime(date(2000, 2, 29)) },
+    { "1400-01-01T00:00:00Z", ptime(date(1400, 1, 1)) },
+    { "9999-12-31T23:59:59.999999Z", ptime(date(9999, 12, 31), hours(24) - microseconds(1)) },
+    { "1400-01-01T00:30:00-01:00", ptime(date(1400, 1, 1), hours(1) + minutes(30)) },
+    { "9999-12-31T23:30:00+01:00", ptime(date(9999, 12, 31), hours(22) + minutes(30)) },
+  };
+  iso8601::parser p;
+  for (std::size_t i = 0; i < sizeof(good) / sizeof(good[0]); ++i) {
+    ptime t;
+    BOOST_CHECK_MESSAGE(p.parse(good[i].text, t) && t == good[i].expect, good[i].text);
+  }
+
+  const char* const bad[] = {
+    "", "2011-07-22", "2011-07-22T23:11", "2011-07-22X23:11:13Z", "2011-13-22T23:11:13Z",
+    "2011-00-22T23:11:13Z", "2011-02-29T23:11:13Z", "1900-02-29T00:00:00Z", "2011-04-31T00:00:00Z",
+    "2011-07-22T24:00:00Z", "2011-07-22T23:60:00Z", "2011-07-22T23:11:60Z", "2011-07-22T23:11:13.Z",
+    "2011-07-22T23:11:13+05", "2011-07-22T23:11:13+0530", "2011-07-22T23:11:13+24:00",
+    "2011-07-22T23:11:13ZZ", "2011-07-22T23:11:13 ", "1399-12-31T23:59:59Z", "2011-7-22T23:11:13Z",
+    "2011-07-22T23:1a:13Z", "-011-07-22T23:11:13Z",
+    // In range as written, not in UTC
+    "1400-01-01T00:30:00+01:00", "9999-12-31T23:30:00-01:00",
+  };
+  for (std::size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    ptime t = friday;
+    BOOST_CHECK_MESSAGE(!p.parse(bad[i], t) && t == friday, bad[i]);
+    // After a good one, so a cached date doesn't let a bad one through
+    BOOST_CHECK(p.parse("2011-07-22T23:11:13Z", t));
+  }
+}
+
+
+
+BOOST_AUTO_TEST_CASE( iso8601_batch ) {
+  using namespace ::boost::posix_time;
+  using ::boost::gregorian::date;
+
+  std::vector<ptime> t;
+  for (int i = 0; i < 1000; ++i)
+    t.push_back(ptime(date(2011, 7, 22)) + seconds(i * 97) + microseconds(i));
+  t[10] = ptime(not_a_date_time);
+
+  // One per line
+  iso8601::formatter f;
+  const std::size_t stride = f.length() + 1;
+  std::vector<char> text(t.size() * stride, '\n');
+  BOOST_CHECK_EQUAL(f.format(&t[0], t.size(), &text[0], stride), t.size() - 1);
+
+  iso8601::parser p;
+  std::vector<ptime> back(t.size());
+  BOOST_CHECK_EQUAL(p.parse(&text[0], t.size(), stride, &back[0]), t.size() - 1);
+  for (std::size_t i = 0; i < t.size(); ++i) {
+    BOOST_CHECK_EQUAL(back[i], t[i]);
+    BOOST_CHECK_EQUAL(text[i * stride + stride - 1], '\n');
+  }
+  BOOST_CHECK_EQUAL(std::string(&text[10 * stride], stride), std::string(f.length(), ' ') + "\n");
+}
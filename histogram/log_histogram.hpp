@@ -0,0 +1,110 @@
+#ifndef LOG_HISTOGRAM_HPP
+#define LOG_HISTOGRAM_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// HDR-style log-linear histogram of non-negative integer values (whatever
+// unit the caller picks: asio/timer records microseconds, the benchmarks
+// and lock-stats nanoseconds). Values are bucketed by their power of two,
+// and each power of two is split in to 2^sub_bits linear sub-buckets, so
+// any reported value is within ~6% of the real one while the whole uint64
+// range fits in a fixed array.
+//
+// record() is a couple of shifts and an increment with no allocation and no
+// locking: each histogram has a single writer, and readers merge() with
+// relaxed loads, so merging one that's still being written to just gives a
+// slightly stale result. The counters are plain integers read and written
+// with the __atomic builtins (relaxed, i.e. ordinary loads and stores on
+// x86) rather than std::atomic or boost::atomic, so this header goes in to
+// C++03 and C++11 builds alike and needs nothing else. GCC or clang only,
+// which __builtin_clzll() needs anyway.
+class log_histogram {
+ public:
+  static const size_t sub_bits = 4;
+  static const size_t sub_buckets = 1 << sub_bits;
+  static const size_t magnitudes = 64 - sub_bits;
+  static const size_t buckets = (magnitudes + 1) * sub_buckets;
+
+  log_histogram() : count_(0), sum_(0), max_(0) {
+    for (size_t i = 0; i < buckets; ++i)
+      counts_[i] = 0;
+  }
+
+  // Single writer only.
+  void record(uint64_t v) {
+    bump(counts_[index_of(v)], 1);
+    bump(count_, 1);
+    bump(sum_, v);
+    if (v > load(max_))
+      store(max_, v);
+  }
+
+  // Safe to call while other is still being written to.
+  void merge(const log_histogram& other) {
+    for (size_t i = 0; i < buckets; ++i)
+      bump(counts_[i], load(other.counts_[i]));
+    bump(count_, other.count());
+    bump(sum_, other.sum());
+    if (other.max() > max())
+      store(max_, other.max());
+  }
+
+  uint64_t count() const { return load(count_); }
+  uint64_t sum() const { return load(sum_); }
+  uint64_t max() const { return load(max_); }
+
+  // Upper bound of the bucket holding the p'th percentile (0 < p <= 100),
+  // never more than max().
+  uint64_t percentile(double p) const {
+    const uint64_t total = count();
+    if (total == 0)
+      return 0;
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+    if (rank == 0)
+      rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets; ++i) {
+      seen += load(counts_[i]);
+      if (seen >= rank) {
+        const uint64_t v = upper_bound_of(i);
+        return v < max() ? v : max();
+      }
+    }
+    return max();
+  }
+
+ private:
+  log_histogram(const log_histogram&);             // Not copyable
+  log_histogram& operator=(const log_histogram&);
+
+  static uint64_t load(const uint64_t& c) { return __atomic_load_n(&c, __ATOMIC_RELAXED); }
+  static void store(uint64_t& c, uint64_t v) { __atomic_store_n(&c, v, __ATOMIC_RELAXED); }
+  static void bump(uint64_t& c, uint64_t n) { store(c, load(c) + n); }
+
+  // Values below sub_buckets map 1:1. Above that, magnitude m (the position
+  // of the highest set bit past sub_bits) selects a row and the next
+  // sub_bits bits select the column.
+  static size_t index_of(uint64_t v) {
+    if (v < sub_buckets)
+      return static_cast<size_t>(v);
+    const size_t msb = 63 - __builtin_clzll(v);
+    const size_t m = msb - sub_bits + 1;
+    return m * sub_buckets + static_cast<size_t>((v >> (msb - sub_bits)) & (sub_buckets - 1));
+  }
+
+  static uint64_t upper_bound_of(size_t i) {
+    if (i < sub_buckets)
+      return i;
+    const size_t m = i / sub_buckets;
+    const uint64_t base = static_cast<uint64_t>(sub_buckets + i % sub_buckets) << (m - 1);
+    return base + (static_cast<uint64_t>(1) << (m - 1)) - 1;
+  }
+
+  uint64_t counts_[buckets];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+
+#endif // LOG_HISTOGRAM_HPP
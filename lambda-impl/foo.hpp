@@ -1,17 +1,40 @@
+#include <iosfwd>
 #include <memory>
 #include <mutex>
 #include <string>
+
+#ifndef LOCK_STATS
+# define LOCK_STATS 0
+#endif
+#if LOCK_STATS
+# include "lock_stats.hpp"
+#endif
+
 namespace MyProject {
 class Foo {
 public:
   typedef std::mutex Mutex;
+#if LOCK_STATS
+  // Records wait and hold time per LockGuard site, see ../lock-stats
+  typedef lock_stats::lock_guard<Mutex> LockGuard;
+#else
   typedef std::lock_guard<Mutex> LockGuard;
+#endif
 
   Foo(const char* str);
   ~Foo();
 
   void mutate_bar();
   const std::string& bar() const;
+
+  // Reference counted copy of bar that stays valid no matter what
+  // mutate_bar() does afterwards. bar()'s reference doesn't.
+  typedef std::shared_ptr<const std::string> bar_snapshot_t;
+  bar_snapshot_t bar_snapshot() const;
+
+  // Writes bar to os. Unlike os << bar(), foo_rope.cpp does this without
+  // flattening bar in to one string first.
+  std::ostream& bar_write(std::ostream& os) const;
 private:
   mutable Mutex mtx_;
   class Impl;
@@ -0,0 +1,304 @@
+// Contention benchmark for MyProject::Foo, linked against one variant at a
+// time (FOO_VARIANT names it). Writer threads share a budget of
+// mutate_bar() calls per round while reader threads call bar_snapshot()
+// until the writers are done; each round starts over with a fresh Foo,
+// because bar doubles with every mutation. Reports latency percentiles per
+// operation, which is where a reader stuck behind a writer's prep shows up.
+//
+// With -g it instead grows one Foo with -m mutate_bar() calls on a single
+// thread and reports the time and heap bytes of each call and the heap
+// in use after it, then the cost of reading the result with bar_write()
+// and bar().
+//
+// -c prints the same results as comma separated lines for scripts, see
+// verify_codegen.sh.
+//
+// Built with -DLOCK_STATS=1 (foo_bench_lock_stats) it also prints the wait
+// and hold times of every LockGuard site on exit.
+
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "foo.hpp"
+
+#ifndef FOO_VARIANT
+# define FOO_VARIANT "unknown"
+#endif
+
+namespace {
+  // Heap usage for -g. Every block carries its counted size in front of it
+  // so delete can tell how much is no longer in use. Only -g counts, so the
+  // contention benchmark's threads don't all fetch_add() the same cache
+  // lines on every allocation: heap_counting is set before any thread
+  // starts, and blocks from before then (or without -g) carry a size of 0.
+  bool heap_counting = false;
+  std::atomic<std::size_t> heap_allocated(0);
+  std::atomic<std::size_t> heap_allocations(0);
+  std::atomic<std::size_t> heap_in_use(0);
+  const std::size_t heap_header = 16;
+} // anon namespace
+
+// Kept out of line so the compiler doesn't pair up inlined malloc()s and
+// free()s with new and delete expressions and complain about it.
+__attribute__((noinline)) void* operator new(std::size_t size) {
+  if (char* p = static_cast<char*>(std::malloc(size + heap_header))) {
+    *reinterpret_cast<std::size_t*>(p) = heap_counting ? size : 0;
+    if (heap_counting) {
+      heap_allocated.fetch_add(size, std::memory_order_relaxed);
+      heap_allocations.fetch_add(1, std::memory_order_relaxed);
+      heap_in_use.fetch_add(size, std::memory_order_relaxed);
+    }
+    return p + heap_header;
+  }
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  if (!p)
+    return;
+  char* block = static_cast<char*>(p) - heap_header;
+  if (const std::size_t size = *reinterpret_cast<std::size_t*>(block))
+    heap_in_use.fetch_sub(size, std::memory_order_relaxed);
+  std::free(block);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+
+namespace {
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct bench_config {
+  unsigned readers = 4;
+  unsigned writers = 2;
+  unsigned rounds = 50;
+  unsigned mutations = 18;   // bar ends up 4 << 18 bytes, i.e. 1MB
+  bool growth = false;
+  bool csv = false;
+  bool read_bar = false;     // Readers call bar() instead of bar_snapshot()
+};
+
+std::uint64_t
+elapsed_ns(const bench_clock::time_point t0) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - t0).count();
+}
+
+// Latencies of one operation, across all threads and rounds
+struct samples {
+  std::vector<std::uint64_t> ns;
+
+  void merge(const std::vector<std::uint64_t>& other) { ns.insert(ns.end(), other.begin(), other.end()); }
+
+  void report(const bench_config& cfg, const char* op, const double wall) {
+    std::sort(ns.begin(), ns.end());
+    const auto pct = [this](double p) {
+      return ns.empty() ? 0 : ns[std::min(ns.size() - 1, std::size_t(p / 100.0 * ns.size()))];
+    };
+    if (cfg.csv) {
+      std::cout << FOO_VARIANT << "," << cfg.readers << "," << cfg.writers << "," << op << ","
+                << ns.size() << "," << pct(50.0) << "," << pct(99.0) << "," << pct(99.9) << ","
+                << (ns.empty() ? 0 : ns.back()) << "\n";
+      return;
+    }
+    std::cout << std::left << std::setw(14) << op << std::right
+              << std::setw(12) << ns.size()
+              << std::setw(14) << std::fixed << std::setprecision(0) << ns.size() / wall
+              << std::setw(10) << pct(50.0) << std::setw(10) << pct(99.0)
+              << std::setw(10) << pct(99.9) << std::setw(12) << (ns.empty() ? 0 : ns.back()) << "\n";
+  }
+};
+
+void
+run(const bench_config& cfg) {
+  samples mutates, reads;
+  double wall = 0;
+  std::uint64_t sink = 0;
+
+  for (unsigned round = 0; round < cfg.rounds; ++round) {
+    MyProject::Foo f("asdf");
+    std::atomic<int> left(cfg.mutations);
+    std::atomic<unsigned> writers_left(cfg.writers);
+    std::vector<std::vector<std::uint64_t>> lat(cfg.readers + cfg.writers);
+    std::vector<std::uint64_t> sinks(cfg.readers);
+    std::vector<std::thread> threads;
+
+    const bench_clock::time_point t0 = bench_clock::now();
+    for (unsigned i = 0; i < cfg.writers; ++i) {
+      threads.emplace_back([&f, &left, &writers_left, &lat, i]() {
+        while (left.fetch_sub(1, std::memory_order_relaxed) > 0) {
+          const bench_clock::time_point t = bench_clock::now();
+          f.mutate_bar();
+          lat[i].push_back(elapsed_ns(t));
+        }
+        writers_left.fetch_sub(1, std::memory_order_release);
+      });
+    }
+    for (unsigned i = 0; i < cfg.readers; ++i) {
+      threads.emplace_back([&f, &writers_left, &lat, &sinks, &cfg, i]() {
+        std::vector<std::uint64_t>& l = lat[cfg.writers + i];
+        while (writers_left.load(std::memory_order_acquire) > 0) {
+          const bench_clock::time_point t = bench_clock::now();
+          // bar()'s reference is only good until the next mutate_bar(),
+          // so don't look through it
+          if (cfg.read_bar)
+            sinks[i] += &f.bar() != nullptr;
+          else
+            sinks[i] += f.bar_snapshot()->size();
+          l.push_back(elapsed_ns(t));
+        }
+      });
+    }
+    for (std::size_t i = 0; i < threads.size(); ++i)
+      threads[i].join();
+    wall += std::chrono::duration<double>(bench_clock::now() - t0).count();
+
+    for (unsigned i = 0; i < cfg.writers; ++i)
+      mutates.merge(lat[i]);
+    for (unsigned i = 0; i < cfg.readers; ++i) {
+      reads.merge(lat[cfg.writers + i]);
+      sink += sinks[i];
+    }
+    if (f.bar().size() != (std::size_t(4) << cfg.mutations))
+      std::cerr << "lost a mutate_bar()\n";
+  }
+
+  if (!cfg.csv) {
+    std::cout << "variant=" << FOO_VARIANT << " readers=" << cfg.readers << " writers=" << cfg.writers
+              << " rounds=" << cfg.rounds << " mutations=" << cfg.mutations << "\n";
+    std::cout << std::left << std::setw(14) << "op" << std::right
+              << std::setw(12) << "ops" << std::setw(14) << "ops/s"
+              << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns"
+              << std::setw(10) << "p999 ns" << std::setw(12) << "max ns" << "\n";
+  }
+  mutates.report(cfg, "mutate_bar", wall);
+  reads.report(cfg, cfg.read_bar ? "bar" : "bar_snapshot", wall);
+
+  // Keeps the reads from being optimized away
+  if (sink == 0 && cfg.readers > 0 && !cfg.csv)
+    std::cout << "(no reads done)\n";
+}
+
+// Throws away whatever is written to it
+struct null_buf : std::streambuf {
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+void
+run_growth(const bench_config& cfg) {
+  if (!cfg.csv) {
+    std::cout << "variant=" << FOO_VARIANT << " mutations=" << cfg.mutations << "\n";
+    std::cout << std::right << std::setw(6) << "call" << std::setw(14) << "bar bytes"
+              << std::setw(14) << "ns" << std::setw(14) << "allocated" << std::setw(14) << "heap in use"
+              << "\n";
+  }
+
+  MyProject::Foo f("asdf");
+  std::uint64_t total_ns = 0;
+  std::size_t total_allocated = 0;
+  const std::size_t allocations0 = heap_allocations.load(std::memory_order_relaxed);
+  for (unsigned i = 1; i <= cfg.mutations; ++i) {
+    const std::size_t allocated0 = heap_allocated.load(std::memory_order_relaxed);
+    const bench_clock::time_point t = bench_clock::now();
+    f.mutate_bar();
+    const std::uint64_t ns = elapsed_ns(t);
+    const std::size_t allocated = heap_allocated.load(std::memory_order_relaxed) - allocated0;
+    total_ns += ns;
+    total_allocated += allocated;
+    if (cfg.csv)
+      continue;
+    std::cout << std::setw(6) << i << std::setw(14) << (std::size_t(4) << i) << std::setw(14) << ns
+              << std::setw(14) << allocated << std::setw(14) << heap_in_use.load(std::memory_order_relaxed)
+              << "\n";
+  }
+  const std::size_t allocations = heap_allocations.load(std::memory_order_relaxed) - allocations0;
+  if (cfg.csv) {
+    std::cout << FOO_VARIANT << ",growth," << cfg.mutations << "," << total_ns << "," << total_allocated
+              << "," << allocations << "\n";
+    if (f.bar().size() != (std::size_t(4) << cfg.mutations))
+      std::cerr << "lost a mutate_bar()\n";
+    return;
+  }
+  std::cout << std::setw(6) << "total" << std::setw(14) << "" << std::setw(14) << total_ns
+            << std::setw(14) << total_allocated << "\n";
+  std::cout << "allocations: " << allocations << "\n";
+
+  null_buf nb;
+  std::ostream null_os(&nb);
+  bench_clock::time_point t = bench_clock::now();
+  f.bar_write(null_os);
+  std::cout << "bar_write() ns: " << elapsed_ns(t) << "\n";
+  t = bench_clock::now();
+  const std::size_t size = f.bar().size();
+  std::cout << "first bar() ns: " << elapsed_ns(t) << "\n";
+  t = bench_clock::now();
+  f.bar();
+  std::cout << "second bar() ns: " << elapsed_ns(t) << "\n";
+  std::cout << "heap in use after bar(): " << heap_in_use.load(std::memory_order_relaxed) << "\n";
+  if (size != (std::size_t(4) << cfg.mutations))
+    std::cerr << "lost a mutate_bar()\n";
+}
+
+void
+usage() {
+  std::cerr << "foo_bench [-b] [-r readers] [-w writers] [-n rounds] [-m mutations]\n"
+            << "foo_bench -g [-m mutations]\n"
+            << "\t-c\t\tComma separated output\n"
+            << "\t-g\t\tGrow one Foo on one thread, report time and memory per call\n"
+            << "\t-b\t\tReaders call bar() instead of bar_snapshot()\n"
+            << "\t-r readers\tThreads calling bar_snapshot() (default: 4)\n"
+            << "\t-w writers\tThreads calling mutate_bar() (default: 2)\n"
+            << "\t-n rounds\tHow many fresh Foos to run through (default: 50)\n"
+            << "\t-m mutations\tmutate_bar() calls per round, bar ends up 4 << m bytes (default: 18)\n";
+}
+
+} // anon namespace
+
+
+int
+main(const int argc, char* const argv[]) {
+  bench_config cfg;
+
+  int ch;
+  while ((ch = ::getopt(argc, argv, "bcgm:n:r:w:")) != -1) {
+    switch (ch) {
+    case 'b': cfg.read_bar = true; break;
+    case 'c': cfg.csv = true; break;
+    case 'g': cfg.growth = true; break;
+    case 'm': cfg.mutations = std::strtoul(optarg, nullptr, 10); break;
+    case 'n': cfg.rounds = std::strtoul(optarg, nullptr, 10); break;
+    case 'r': cfg.readers = std::strtoul(optarg, nullptr, 10); break;
+    case 'w': cfg.writers = std::strtoul(optarg, nullptr, 10); break;
+    default:
+      usage();
+      return EX_USAGE;
+    }
+  }
+  if (cfg.writers == 0 || cfg.mutations > 28) {
+    usage();
+    return EX_USAGE;
+  }
+
+  heap_counting = cfg.growth;
+  if (cfg.growth)
+    run_growth(cfg);
+  else
+    run(cfg);
+#if LOCK_STATS
+  if (!cfg.csv)
+    lock_stats::dump(std::cout);
+#endif
+  return EX_OK;
+}
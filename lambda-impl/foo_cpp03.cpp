@@ -4,7 +4,6 @@
 
 namespace MyProject {
 class Foo;
-class Foo::Impl;
 
 class Foo::Impl {
 public:
@@ -46,8 +45,20 @@ const std::string& Foo::bar() const {
   return impl_->bar();
 }
 
+Foo::bar_snapshot_t Foo::bar_snapshot() const {
+  LockGuard lk(mtx_);
+  return std::make_shared<const std::string>(impl_->bar());
+}
+
+std::ostream& Foo::bar_write(std::ostream& os) const {
+  LockGuard lk(mtx_);
+  return os << impl_->bar();
+}
+
 } // MyProject
 
+// Benchmarks bring their own main()
+#ifndef FOO_NO_MAIN
 int main() {
   MyProject::Foo f("asdf");
   std::cout << "f.bar(): " << f.bar() << std::endl;
@@ -55,3 +66,4 @@ int main() {
   std::cout << "f.bar(): " << f.bar() << std::endl;
   return 0;
 }
+#endif // FOO_NO_MAIN
@@ -0,0 +1,79 @@
+#include <iostream>
+
+#include "foo.hpp"
+#include "txn.hpp"
+
+namespace MyProject {
+
+class Foo::Impl {
+public:
+  Impl(const char* str, Foo::Mutex& mtx) : bar_(str), mutations_(0), group_(mtx) {}
+  const std::string& bar() const { return bar_; }
+  void mutate_bar();
+
+  std::string bar_;
+  unsigned long mutations_;
+
+private:
+  txn::GroupCommit<Impl, Foo::Mutex, Foo::LockGuard> group_;
+};
+
+// foo_cpp11.cpp's mutate_bar() as a txn over two fields, batched with every
+// other thread's mutate_bar() instead of each taking Foo::mtx_ in turn.
+void Foo::Impl::mutate_bar() {
+  struct NewState {
+    std::string bar;
+    unsigned long mutations;
+  };
+
+  // Mutate dst to your heart's content, "self" is const protected, go crazy
+  auto prep = [](const Impl& self, NewState& dst) {
+    dst.bar = self.bar_ + self.bar_;
+    dst.mutations = self.mutations_ + 1;
+  };
+
+  // Per http://exceptionsafecode.com/, don't throw below this line -
+  // enforced by txn::apply()
+  auto commit = [](NewState& src, Impl& dst) noexcept {
+    dst.bar_.swap(src.bar);
+    dst.mutations_ = src.mutations;
+  };
+
+  group_.run<NewState>(*this, prep, commit);
+};
+
+Foo::Foo(const char* str) : impl_(new Foo::Impl(str, mtx_)) {}
+Foo::~Foo() {}
+
+// The group commit leader takes mtx_, see txn::GroupCommit
+void Foo::mutate_bar() {
+  impl_->mutate_bar();
+}
+
+const std::string& Foo::bar() const {
+  LockGuard lk(mtx_);
+  return impl_->bar();
+}
+
+Foo::bar_snapshot_t Foo::bar_snapshot() const {
+  LockGuard lk(mtx_);
+  return std::make_shared<const std::string>(impl_->bar());
+}
+
+std::ostream& Foo::bar_write(std::ostream& os) const {
+  LockGuard lk(mtx_);
+  return os << impl_->bar();
+}
+
+} // MyProject
+
+// Benchmarks bring their own main()
+#ifndef FOO_NO_MAIN
+int main() {
+  MyProject::Foo f("asdf");
+  std::cout << "f.bar(): " << f.bar() << std::endl;
+  f.mutate_bar();
+  std::cout << "f.bar(): " << f.bar() << std::endl;
+  return 0;
+}
+#endif // FOO_NO_MAIN
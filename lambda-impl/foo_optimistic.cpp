@@ -0,0 +1,104 @@
+#include <atomic>
+#include <iostream>
+
+#include "foo.hpp"
+
+namespace MyProject {
+
+// Same prepare/commit split as foo_cpp11.cpp, but optimistic: bar_ lives in
+// an immutable, reference counted State. prep works on whatever State was
+// current when it started, without holding mtx_, and commit swaps in the
+// new State only if nobody else committed in the meantime; otherwise prep
+// runs again against the newer one. The State pointer doubles as its
+// version: as long as prep holds on to it, it can't be freed and reused,
+// so a stale pointer never compares equal by accident.
+//
+// Readers never wait for a prep to finish, at the price of writers
+// throwing away their work when they collide. They aren't lock-free
+// either: std::atomic_*() on a shared_ptr locks one of a small pool of
+// pthread mutexes, picked by hashing the shared_ptr's address, in
+// libstdc++ (libc++ does the same), held for the pointer copy or swap
+// only.
+//
+// bar() hands out a plain reference in to the current State, which goes
+// away with the next mutate_bar(): like the locking variants' reference,
+// it's only good until then. Readers that need bar to outlive a
+// mutate_bar() take a bar_snapshot() instead.
+class Foo::Impl {
+public:
+  struct State {
+    std::string bar;
+  };
+  typedef std::shared_ptr<const State> StatePtr;
+
+  Impl(const char* str) : state_(std::make_shared<const State>(State{str})) {}
+  const std::string& bar() const { return std::atomic_load(&state_)->bar; }
+  Foo::bar_snapshot_t bar_snapshot() const {
+    // Aliasing constructor: shares ownership of the State, points at bar
+    StatePtr s = std::atomic_load(&state_);
+    return Foo::bar_snapshot_t(s, &s->bar);
+  }
+  void mutate_bar();
+
+private:
+  StatePtr state_;
+};
+
+void Foo::Impl::mutate_bar() {
+  // Mutate dst to your heart's content, "self" is const protected and
+  // nobody else can see dst until it's committed, go crazy
+  auto prep = [](const State& self, State& dst) {
+    dst.bar = self.bar + self.bar;
+  };
+
+  // Per http://exceptionsafecode.com/, don't throw below this line -
+  // enforced via commit()'s noexcept. Returns false, with expected updated
+  // to the current State, if another commit got there first.
+  auto commit = [](StatePtr& expected, StatePtr& src, StatePtr& dst) noexcept {
+    return std::atomic_compare_exchange_strong(&dst, &expected, src);
+  };
+
+  StatePtr cur = std::atomic_load(&state_);
+  for (;;) {
+    std::shared_ptr<State> next = std::make_shared<State>();
+    prep(*cur, *next);
+    StatePtr src(std::move(next));
+    if (commit(cur, src, state_))
+      break;
+  }
+};
+
+Foo::Foo(const char* str) : impl_(new Foo::Impl(str)) {}
+Foo::~Foo() {}
+
+// No lock: see Foo::Impl. mtx_ goes unused in this variant.
+void Foo::mutate_bar() {
+  impl_->mutate_bar();
+}
+
+// Only valid until the next mutate_bar(), see Foo::Impl. Use
+// bar_snapshot() to hold on to bar past that.
+const std::string& Foo::bar() const {
+  return impl_->bar();
+}
+
+Foo::bar_snapshot_t Foo::bar_snapshot() const {
+  return impl_->bar_snapshot();
+}
+
+std::ostream& Foo::bar_write(std::ostream& os) const {
+  return os << *impl_->bar_snapshot();
+}
+
+} // MyProject
+
+// Benchmarks bring their own main()
+#ifndef FOO_NO_MAIN
+int main() {
+  MyProject::Foo f("asdf");
+  std::cout << "f.bar(): " << f.bar() << std::endl;
+  f.mutate_bar();
+  std::cout << "f.bar(): " << f.bar() << std::endl;
+  return 0;
+}
+#endif // FOO_NO_MAIN
@@ -0,0 +1,146 @@
+#include <iostream>
+
+#include "foo.hpp"
+#include "rope.hpp"
+
+namespace MyProject {
+
+// foo_cpp11.cpp with bar_ as a Rope: mutate_bar() allocates one node that
+// points at the old bar_ twice instead of copying it, so neither its time
+// nor the memory behind bar_ doubles with every call. bar() and
+// bar_snapshot() still hand out a std::string, which is flattened on first
+// use after a mutation and then shared by both; bar_write() streams the
+// chunks and never flattens.
+//
+// Flattening is O(size), so it happens outside mtx_ on a copy of the Rope
+// (a reference count, like bar_write()), and the result is published
+// under mtx_ afterwards, unless a newer version got published first. Impl
+// only holds on to the newest flat; bar() returns a reference in to it,
+// which like the other variants' is only good until the next mutate_bar().
+class Foo::Impl {
+public:
+  struct Flat {
+    std::string str;
+    unsigned long version;   // The version_ of bar_ str is
+  };
+  typedef std::shared_ptr<const Flat> FlatPtr;
+
+  Impl(const char* str) : bar_(str), version_(0) {}
+
+  // The current bar_ flattened, or null if nobody has flattened it yet
+  Foo::bar_snapshot_t flat() const {
+    if (flat_ && flat_->version == version_)
+      return Foo::bar_snapshot_t(flat_, &flat_->str);   // Aliasing constructor
+    return nullptr;
+  }
+
+  // Makes f the newest flat and returns its str. If someone else already
+  // published the same version, returns theirs; if they published a newer
+  // one, returns f's str without holding on to it.
+  Foo::bar_snapshot_t publish(std::shared_ptr<Flat> f) {
+    if (flat_ && flat_->version == f->version)
+      return Foo::bar_snapshot_t(flat_, &flat_->str);
+    if (flat_ && flat_->version > f->version)
+      return Foo::bar_snapshot_t(f, &f->str);
+    flat_ = std::move(f);
+    return Foo::bar_snapshot_t(flat_, &flat_->str);
+  }
+
+  // True if s points in to the newest flat
+  bool published(const Foo::bar_snapshot_t& s) const {
+    return flat_ && s.get() == &flat_->str;
+  }
+
+  void mutate_bar();
+
+  Rope bar_;
+  unsigned long version_;   // Bumped by every mutate_bar()
+
+  // Newest flattening of bar_ (of whatever version), or null
+  FlatPtr flat_;
+};
+
+void Foo::Impl::mutate_bar() {
+  struct {
+    Rope bar;
+  } newBar;
+
+  // Mutate newBar to your heart's content, "self" is const protected, go crazy
+  auto prep = [](const decltype(*this)& self, decltype(newBar)& dst) {
+    dst.bar = self.bar_ + self.bar_;
+  };
+
+  // Per http://exceptionsafecode.com/, don't throw below this line -
+  // enforced via commit()'s noexcept
+  auto commit = [](decltype(newBar)& src, decltype(*this)& dst) noexcept {
+    dst.bar_ = std::move(src.bar);
+    ++dst.version_;
+  };
+
+  prep(*this, newBar);
+  commit(newBar, *this);
+};
+
+Foo::Foo(const char* str) : impl_(new Foo::Impl(str)) {}
+Foo::~Foo() {}
+
+void Foo::mutate_bar() {
+  LockGuard lk(mtx_);
+  impl_->mutate_bar();
+}
+
+// Only valid until the next mutate_bar(), see Foo::Impl. Impl's flat_ is
+// what keeps the string alive, so if a mutate_bar() got in while this
+// flattened and ours came out stale, flatten the newer version instead.
+const std::string& Foo::bar() const {
+  for (;;) {
+    Foo::bar_snapshot_t s = bar_snapshot();
+    LockGuard lk(mtx_);
+    if (impl_->published(s))
+      return *s;
+  }
+}
+
+Foo::bar_snapshot_t Foo::bar_snapshot() const {
+  Rope bar;
+  unsigned long version;
+  {
+    LockGuard lk(mtx_);
+    if (Foo::bar_snapshot_t s = impl_->flat())
+      return s;
+    bar = impl_->bar_;
+    version = impl_->version_;
+  }
+
+  // Readers racing on the same version each flatten it, and the first one
+  // to publish wins
+  std::shared_ptr<Impl::Flat> f = std::make_shared<Impl::Flat>();
+  f->str = bar.str();
+  f->version = version;
+  LockGuard lk(mtx_);
+  return impl_->publish(std::move(f));
+}
+
+// Streams a copy of the Rope, which is just a reference count, so mtx_
+// isn't held while os does its thing
+std::ostream& Foo::bar_write(std::ostream& os) const {
+  Rope bar;
+  {
+    LockGuard lk(mtx_);
+    bar = impl_->bar_;
+  }
+  return os << bar;
+}
+
+} // MyProject
+
+// Benchmarks bring their own main()
+#ifndef FOO_NO_MAIN
+int main() {
+  MyProject::Foo f("asdf");
+  std::cout << "f.bar(): " << f.bar() << std::endl;
+  f.mutate_bar();
+  std::cout << "f.bar(): " << f.bar() << std::endl;
+  return 0;
+}
+#endif // FOO_NO_MAIN
@@ -0,0 +1,110 @@
+#ifndef MYPROJECT_ROPE_HPP
+#define MYPROJECT_ROPE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace MyProject {
+
+// Immutable string made of reference counted chunks. Concatenating two
+// Ropes allocates one node that points at both of them, whatever their
+// size, and since nodes never change a Rope can point at the same node
+// twice: r + r is O(1) and takes no more memory than r plus a node.
+//
+// Reading it back is either str(), which flattens it in to one
+// std::string (O(size)), or for_each_chunk() / operator<<, which walk
+// the chunks in order without building one.
+//
+// Every concatenation makes the tree one level deeper (not counting small
+// ones, which are merged in to a single chunk). Past max_depth the result
+// is flattened instead, so appending many small pieces costs an O(size)
+// copy once every max_depth appends; doubling never gets there.
+class Rope {
+public:
+  // Concatenations that come out at most this long are stored as one chunk
+  static const std::size_t small_size = 64;
+  static const unsigned max_depth = 64;
+
+  Rope() {}
+  Rope(const char* str) : Rope(std::string(str)) {}
+  Rope(std::string str) {
+    if (!str.empty())
+      root_ = std::make_shared<const Node>(std::move(str));
+  }
+
+  std::size_t size() const { return root_ ? root_->size : 0; }
+  bool empty() const { return size() == 0; }
+  unsigned depth() const { return root_ ? root_->depth : 0; }
+
+  friend Rope operator+(const Rope& a, const Rope& b) {
+    if (a.empty())
+      return b;
+    if (b.empty())
+      return a;
+    if (a.size() + b.size() <= small_size || std::max(a.depth(), b.depth()) >= max_depth)
+      return Rope(a.str() + b.str());
+    return Rope(std::make_shared<const Node>(a.root_, b.root_));
+  }
+
+  Rope& operator+=(const Rope& other) { return *this = *this + other; }
+
+  // Calls f(const char* data, std::size_t len) for every chunk, in order
+  template <typename F>
+  void for_each_chunk(F&& f) const {
+    if (!root_)
+      return;
+    std::vector<const Node*> stack;
+    stack.reserve(root_->depth + 1);
+    stack.push_back(root_.get());
+    while (!stack.empty()) {
+      const Node* n = stack.back();
+      stack.pop_back();
+      if (n->leaf()) {
+        f(n->chunk.data(), n->chunk.size());
+      } else {
+        stack.push_back(n->right.get());
+        stack.push_back(n->left.get());
+      }
+    }
+  }
+
+  std::string str() const {
+    std::string s;
+    s.reserve(size());
+    for_each_chunk([&s](const char* p, std::size_t n) { s.append(p, n); });
+    return s;
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const Rope& r) {
+    r.for_each_chunk([&os](const char* p, std::size_t n) { os.write(p, n); });
+    return os;
+  }
+
+private:
+  struct Node {
+    typedef std::shared_ptr<const Node> Ptr;
+
+    explicit Node(std::string str) : size(str.size()), depth(1), chunk(std::move(str)) {}
+    Node(Ptr l, Ptr r)
+      : size(l->size + r->size), depth(1 + std::max(l->depth, r->depth)), left(std::move(l)), right(std::move(r)) {}
+
+    bool leaf() const { return !left; }
+
+    const std::size_t size;
+    const unsigned depth;
+    const Ptr left, right;    // Both set, or neither and this is a chunk
+    const std::string chunk;
+  };
+
+  explicit Rope(Node::Ptr root) : root_(std::move(root)) {}
+
+  Node::Ptr root_;
+};
+
+} // namespace MyProject
+
+#endif // MYPROJECT_ROPE_HPP
@@ -0,0 +1,153 @@
+#ifndef MYPROJECT_TXN_HPP
+#define MYPROJECT_TXN_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace MyProject {
+namespace txn {
+
+// The prepare/commit split of foo_cpp03.cpp's impl_helper::bar_1stage() /
+// bar_2commit() and foo_cpp11.cpp's prep/commit lambdas, for any number of
+// an Impl's fields. Staged holds the new values:
+//
+//   prep(const Impl& self, Staged& dst)     may throw, can't touch self
+//   commit(Staged& src, Impl& dst) noexcept  swaps them in to place
+//
+// so an exception from prep leaves Impl exactly as it was. The caller
+// holds whatever lock guards Impl.
+template <typename Staged, typename Impl, typename Prep, typename Commit>
+void apply(Impl& impl, Prep&& prep, Commit&& commit) {
+  static_assert(noexcept(commit(std::declval<Staged&>(), impl)),
+                "commit must be noexcept, see http://exceptionsafecode.com/");
+  Staged staged;
+  prep(static_cast<const Impl&>(impl), staged);
+  commit(staged, impl);
+}
+
+
+// Group commit of apply()s against one Impl. Each caller queues its
+// transaction; whoever finds no leader becomes it, takes mtx (the lock that
+// guards Impl everywhere else, e.g. Foo::mtx_) once, applies every queued
+// transaction in submission order and wakes their callers. Under
+// contention that's one handoff of mtx per batch instead of one per
+// transaction. Callers never see each other's exceptions: a prep that
+// throws is skipped and its caller gets the exception back. LockGuard is
+// what the leader holds mtx with, e.g. Foo::LockGuard.
+//
+// The catch is that the leader holds mtx for the whole batch, i.e. for N
+// preps back to back rather than one, and anything else that takes mtx
+// (a reader of Impl, say) can wait that long. Fine when preps are short
+// and writers dominate; with long preps and latency sensitive readers,
+// apply() under the plain lock is the better deal.
+template <typename Impl, typename Mutex = std::mutex, typename LockGuard = std::lock_guard<Mutex> >
+class GroupCommit {
+public:
+  explicit GroupCommit(Mutex& mtx) : mtx_(mtx), leader_(false) {}
+  GroupCommit(const GroupCommit&) = delete;
+  GroupCommit& operator=(const GroupCommit&) = delete;
+
+  // apply<Staged>(impl, prep, commit), batched with everyone else's.
+  // Returns once it's been committed; rethrows prep's exception.
+  template <typename Staged, typename Prep, typename Commit>
+  void run(Impl& impl, Prep&& prep, Commit&& commit) {
+    // Lives on this stack frame until the leader is done with it, so
+    // queueing doesn't allocate anything (bar the queue growing).
+    struct Closure {
+      Prep& prep;
+      Commit& commit;
+      static void call(void* self, Impl& impl) {
+        Closure& c = *static_cast<Closure*>(self);
+        apply<Staged>(impl, c.prep, c.commit);
+      }
+    } closure{prep, commit};
+    Request req(&Closure::call, &closure, impl);
+
+    // A leader applies one batch and steps down, and a waiter whose
+    // transaction wasn't in it takes over, so nobody leads forever.
+    std::unique_lock<std::mutex> lk(queue_mtx_);
+    queue_.push_back(&req);
+    while (!req.done) {
+      if (leader_) {
+        done_.wait(lk);
+        continue;
+      }
+      Leadership leading(*this, lk);
+      lead(lk);
+    }
+    if (req.error)
+      std::rethrow_exception(req.error);
+  }
+
+private:
+  struct Request {
+    Request(void (*f)(void*, Impl&), void* c, Impl& i) : fn(f), ctx(c), impl(i), done(false) {}
+    void (*fn)(void*, Impl&);
+    void* ctx;
+    Impl& impl;
+    bool done;
+    std::exception_ptr error;
+  };
+
+  // Makes the caller leader while it's in scope. Stepping down in the
+  // destructor means it also happens if lead() throws; otherwise leader_
+  // would stay set and every waiter would sleep forever.
+  class Leadership {
+  public:
+    Leadership(GroupCommit& gc, std::unique_lock<std::mutex>& lk) : gc_(gc), lk_(lk) {
+      gc_.leader_ = true;
+    }
+    ~Leadership() {
+      if (!lk_.owns_lock())
+        lk_.lock();
+      gc_.leader_ = false;
+      gc_.done_.notify_all();
+    }
+  private:
+    GroupCommit& gc_;
+    std::unique_lock<std::mutex>& lk_;
+  };
+
+  // Takes the whole queue and applies it under mtx_, with the queue
+  // unlocked so more callers can line up for the next batch.
+  void lead(std::unique_lock<std::mutex>& lk) {
+    batch_.swap(queue_);
+    lk.unlock();
+    try {
+      LockGuard impl_lk(mtx_);
+      for (std::size_t i = 0; i < batch_.size(); ++i) {
+        try {
+          batch_[i]->fn(batch_[i]->ctx, batch_[i]->impl);
+        } catch (...) {
+          batch_[i]->error = std::current_exception();
+        }
+      }
+    } catch (...) {
+      // Only taking mtx_ gets here (e.g. std::system_error), before any of
+      // the batch ran: every caller in it gets that back
+      for (std::size_t i = 0; i < batch_.size(); ++i)
+        batch_[i]->error = std::current_exception();
+    }
+    lk.lock();
+    for (std::size_t i = 0; i < batch_.size(); ++i)
+      batch_[i]->done = true;
+    batch_.clear();
+  }
+
+  Mutex& mtx_;
+
+  // Guards everything below. Only ever held for a push or a swap.
+  std::mutex queue_mtx_;
+  std::condition_variable done_;
+  bool leader_;
+  std::vector<Request*> queue_;
+  std::vector<Request*> batch_;   // Only touched by the leader
+};
+
+} // namespace txn
+} // namespace MyProject
+
+#endif // MYPROJECT_TXN_HPP
@@ -0,0 +1,130 @@
+#!/bin/sh
+# Checks the claim in GNUmakefile that foo_cpp11.cpp's prep/commit lambdas
+# cost nothing over foo_cpp03.cpp's hand written helpers:
+#
+#  1. Compiles both to assembly with ${CXX} ${CXXFLAGS} and diffs
+#     Foo::Impl::mutate_bar(), plus whatever MyProject functions it calls
+#     out of line, with labels and assembler directives stripped. The
+#     diff is informational; more instructions in cpp11 is a regression.
+#  2. Grows a Foo with foo_bench -g in both and compares the number of
+#     heap allocations and bytes. Any difference is a regression.
+#  3. Runs foo_bench with 1..THREADS writers and as many readers, REPEATS
+#     times each, alternating between the two, and reports the best p50
+#     latency of mutate_bar() and bar(). This is for information only:
+#     run to run noise easily exceeds the difference, so cpp11 more than
+#     TOLERANCE percent (and MIN_NS) slower gets a note, not a failure.
+#     A p50 of 0 means no usable samples and is reported as invalid
+#     rather than compared.
+#
+# Exits non-zero if 1. or 2. regressed. Run it through `make verify`,
+# which builds foo_bench_cpp03 and foo_bench_cpp11 first.
+
+CXX=${CXX:-c++}
+CXXFLAGS=${CXXFLAGS:--O3 -std=c++11}
+THREADS=${THREADS:-4}
+ROUNDS=${ROUNDS:-50}
+REPEATS=${REPEATS:-5}
+TOLERANCE=${TOLERANCE:-25}
+MIN_NS=${MIN_NS:-200}
+WORK=${WORK:-verify.out}
+
+SYM=_ZN9MyProject3Foo4Impl10mutate_barEv
+
+mkdir -p "${WORK}" || exit 1
+failed=0
+
+# Instructions of function $2 (and its .cold part) in assembly file $1, one
+# per line, with jump targets renamed so they don't differ by number.
+extract() {
+	awk -v sym="$2" '
+		$0 ~ "^_?" sym "(\\.cold[.0-9]*)?:" { p = 1; next }
+		p && /\.cfi_endproc/ { p = 0; next }
+		p && /^[^ \t]/ { next }
+		p && /^[ \t]*\./ { next }
+		p && NF > 0 {
+			gsub(/\.L[A-Za-z0-9_]+/, ".L")
+			sub(/^[ \t]+/, "")
+			gsub(/[ \t]+/, " ")
+			print
+		}' "$1"
+}
+
+# extract() plus every MyProject function it calls that's defined in $1
+extract_inclusive() {
+	extract "$1" "$2"
+	extract "$1" "$2" | awk '$1 ~ /^(call|jmp)/ && $2 ~ /^_/ { sub(/@PLT$/, "", $2); print $2 }' | sort -u |
+	while read -r callee; do
+		case "${callee}" in
+		_ZN9MyProject*|__ZN9MyProject*)
+			extract "$1" "${callee#_}" ;;
+		esac
+	done
+}
+
+echo "== codegen: Foo::Impl::mutate_bar() (${CXX} ${CXXFLAGS})"
+for v in cpp03 cpp11; do
+	${CXX} ${CXXFLAGS} -S -o "${WORK}/foo_${v}.s" "foo_${v}.cpp" || exit 1
+	extract "${WORK}/foo_${v}.s" "${SYM}" > "${WORK}/mutate_bar_${v}.txt"
+	extract_inclusive "${WORK}/foo_${v}.s" "${SYM}" > "${WORK}/mutate_bar_${v}_inclusive.txt"
+done
+insns03=$(wc -l < "${WORK}/mutate_bar_cpp03_inclusive.txt")
+insns11=$(wc -l < "${WORK}/mutate_bar_cpp11_inclusive.txt")
+if diff -u "${WORK}/mutate_bar_cpp03.txt" "${WORK}/mutate_bar_cpp11.txt" > "${WORK}/mutate_bar.diff"; then
+	echo "identical"
+else
+	echo "differs, see ${WORK}/mutate_bar.diff"
+fi
+echo "instructions incl. out of line callees: cpp03=${insns03} cpp11=${insns11}"
+if [ "${insns03}" -eq 0 ] || [ "${insns11}" -eq 0 ]; then
+	echo "FAIL: couldn't find ${SYM} in the assembly"
+	failed=1
+elif [ "${insns11}" -gt "${insns03}" ]; then
+	echo "REGRESSION: cpp11 has more instructions"
+	failed=1
+fi
+
+echo "== allocations: foo_bench -g"
+./foo_bench_cpp03 -c -g > "${WORK}/growth_cpp03.csv" || exit 1
+./foo_bench_cpp11 -c -g > "${WORK}/growth_cpp11.csv" || exit 1
+# variant,growth,mutations,total_ns,allocated_bytes,allocations
+cat "${WORK}/growth_cpp03.csv" "${WORK}/growth_cpp11.csv"
+if ! awk -F, 'NR == 1 { b = $5; a = $6 } NR == 2 { exit !($5 <= b && $6 <= a) }' \
+		"${WORK}/growth_cpp03.csv" "${WORK}/growth_cpp11.csv"; then
+	echo "REGRESSION: cpp11 allocates more"
+	failed=1
+fi
+
+echo "== latency: foo_bench, best p50 ns of ${REPEATS} runs"
+t=1
+while [ "${t}" -le "${THREADS}" ]; do
+	out="${WORK}/latency_${t}.csv"
+	: > "${out}"
+	r=0
+	while [ "${r}" -lt "${REPEATS}" ]; do
+		for v in cpp03 cpp11; do
+			./foo_bench_${v} -c -b -n "${ROUNDS}" -w "${t}" -r "${t}" >> "${out}" || exit 1
+		done
+		r=$((r + 1))
+	done
+	# variant,readers,writers,op,ops,p50,p99,p999,max
+	awk -F, -v tol="${TOLERANCE}" -v min_ns="${MIN_NS}" -v t="${t}" '
+		{ ops[$4] = 1 }
+		$5 > 0 && $6 > 0 && (!(($1, $4) in best) || $6 < best[$1, $4]) { best[$1, $4] = $6 }
+		END {
+			for (op in ops) {
+				a = best["cpp03", op]; b = best["cpp11", op]
+				printf "threads=%d %-14s cpp03=%d cpp11=%d\n", t, op, a, b
+				if (a == 0 || b == 0)
+					printf "invalid: no nonzero p50 for %s, not compared\n", op
+				else if (b > a * (1 + tol / 100) && b - a > min_ns)
+					printf "note: %s is more than %d%% slower in cpp11\n", op, tol
+			}
+		}' "${out}"
+	t=$((t + 1))
+done
+
+if [ "${failed}" -ne 0 ]; then
+	echo "FAILED"
+	exit 1
+fi
+echo "OK"
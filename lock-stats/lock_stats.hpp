@@ -0,0 +1,282 @@
+#ifndef LOCK_STATS_HPP
+#define LOCK_STATS_HPP
+
+// Drop-in lock types that time every acquisition and hold, per lock site.
+// Build with -DLOCK_STATS=1 to get them; without it this header is empty
+// and callers are expected to fall back to their usual lock types, so the
+// instrumentation costs nothing unless it was asked for:
+//
+//   #if LOCK_STATS
+//   typedef lock_stats::lock_guard<std::mutex> LockGuard;
+//   #else
+//   typedef std::lock_guard<std::mutex> LockGuard;
+//   #endif
+//
+// A lock site is where the lock object was constructed, file:line plus the
+// function, picked up through the constructor's default arguments. Each
+// thread keeps its own histograms per site, so recording never takes a lock
+// or touches a cache line another thread writes; lock_stats::dump() merges
+// them. Needs C++11 and __builtin_FILE() et al. (GCC >= 4.8, clang >= 9).
+
+#ifndef LOCK_STATS
+# define LOCK_STATS 0
+#endif
+
+#if LOCK_STATS
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "log_histogram.hpp"
+
+namespace lock_stats {
+
+enum lock_kind { exclusive, shared };
+
+// Where a lock was taken. The strings are literals from __builtin_FILE()
+// and __builtin_FUNCTION(), so they outlive everything.
+struct site {
+  const char* function;
+  const char* file;
+  unsigned line;
+  lock_kind kind;
+};
+
+// One site as seen by one thread, which is the only writer. wait has a
+// sample for every acquisition, 0 when try_lock() got it straight away.
+struct site_stats {
+  explicit site_stats(const site& s) : where(s), contended(0) {}
+
+  void acquired(std::uint64_t wait_ns, bool was_contended) {
+    wait.record(wait_ns);
+    if (was_contended)
+      contended.store(contended.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  void released(std::uint64_t hold_ns) { hold.record(hold_ns); }
+
+  const site where;
+  log_histogram wait;   // ns
+  log_histogram hold;   // ns
+  std::atomic<std::uint64_t> contended;
+};
+
+// Every thread's site_stats, created on first use and kept until the
+// program exits so they can still be dumped after their threads are gone.
+class registry {
+public:
+  static registry& instance() {
+    static registry r;
+    return r;
+  }
+
+  site_stats& local(const site& s) {
+    static thread_local thread_sites* t = nullptr;
+    if (!t) {
+      std::unique_ptr<thread_sites> p(new thread_sites);
+      t = p.get();
+      std::lock_guard<std::mutex> lk(mtx_);
+      threads_.push_back(std::move(p));
+    }
+    // Only this thread inserts in to t->sites, so it can look without
+    // t->mtx; dump() takes it to read.
+    const key k = { s.file, s.line, s.kind };
+    auto it = t->sites.find(k);
+    if (it == t->sites.end()) {
+      std::unique_ptr<site_stats> st(new site_stats(s));
+      std::lock_guard<std::mutex> lk(t->mtx);
+      it = t->sites.emplace(k, std::move(st)).first;
+    }
+    return *it->second;
+  }
+
+  // Merges every thread's stats per site and prints one line per site, the
+  // sites that spent the most time waiting first. Times are in ns.
+  void dump(std::ostream& os) {
+    struct merged {
+      site where;
+      log_histogram wait;
+      log_histogram hold;
+      std::uint64_t contended = 0;
+    };
+    std::map<std::string, std::unique_ptr<merged>> sites;
+    {
+      std::lock_guard<std::mutex> lk(mtx_);
+      for (const auto& t : threads_) {
+        std::lock_guard<std::mutex> tlk(t->mtx);
+        for (const auto& kv : t->sites) {
+          const site_stats& st = *kv.second;
+          std::unique_ptr<merged>& m = sites[name_of(st.where)];
+          if (!m) {
+            m.reset(new merged);
+            m->where = st.where;
+          }
+          m->wait.merge(st.wait);
+          m->hold.merge(st.hold);
+          m->contended += st.contended.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    std::vector<const merged*> order;
+    for (const auto& kv : sites)
+      order.push_back(kv.second.get());
+    std::stable_sort(order.begin(), order.end(), [](const merged* a, const merged* b) {
+      return a->wait.sum() > b->wait.sum();
+    });
+
+    os << std::setw(10) << "acquires" << std::setw(10) << "contended"
+       << std::setw(12) << "wait p50" << std::setw(12) << "wait p99" << std::setw(12) << "wait max"
+       << std::setw(12) << "wait total"
+       << std::setw(12) << "hold p50" << std::setw(12) << "hold p99" << std::setw(12) << "hold max"
+       << "  lock site\n";
+    for (const merged* m : order) {
+      os << std::setw(10) << m->wait.count() << std::setw(10) << m->contended
+         << std::setw(12) << m->wait.percentile(50.0) << std::setw(12) << m->wait.percentile(99.0)
+         << std::setw(12) << m->wait.max() << std::setw(12) << m->wait.sum()
+         << std::setw(12) << m->hold.percentile(50.0) << std::setw(12) << m->hold.percentile(99.0)
+         << std::setw(12) << m->hold.max() << "  " << name_of(m->where) << "\n";
+    }
+  }
+
+private:
+  struct key {
+    const char* file;
+    unsigned line;
+    lock_kind kind;
+
+    bool operator==(const key& o) const { return file == o.file && line == o.line && kind == o.kind; }
+  };
+
+  struct key_hash {
+    std::size_t operator()(const key& k) const {
+      return std::hash<const char*>()(k.file) ^ (std::size_t(k.line) << 1 | k.kind);
+    }
+  };
+
+  struct thread_sites {
+    std::mutex mtx;   // Inserting vs. dump()
+    std::unordered_map<key, std::unique_ptr<site_stats>, key_hash> sites;
+  };
+
+  registry() {}
+  registry(const registry&) = delete;
+  registry& operator=(const registry&) = delete;
+
+  // "example.cpp:388 bar() shared". Sites are keyed by the file's address
+  // per thread, which can differ between translation units for the same
+  // file, so merging goes by name.
+  static std::string name_of(const site& s) {
+    const char* base = std::strrchr(s.file, '/');
+    std::ostringstream os;
+    os << (base ? base + 1 : s.file) << ":" << s.line << " " << s.function << "()"
+       << (s.kind == shared ? " shared" : "");
+    return os.str();
+  }
+
+  std::mutex mtx_;
+  std::vector<std::unique_ptr<thread_sites>> threads_;
+};
+
+namespace detail {
+
+struct exclusive_ops {
+  static const lock_kind kind = exclusive;
+  template <typename Mutex> static bool try_lock(Mutex& m) { return m.try_lock(); }
+  template <typename Mutex> static void lock(Mutex& m) { m.lock(); }
+  template <typename Mutex> static void unlock(Mutex& m) { m.unlock(); }
+};
+
+struct shared_ops {
+  static const lock_kind kind = shared;
+  template <typename Mutex> static bool try_lock(Mutex& m) { return m.try_lock_shared(); }
+  template <typename Mutex> static void lock(Mutex& m) { m.lock_shared(); }
+  template <typename Mutex> static void unlock(Mutex& m) { m.unlock_shared(); }
+};
+
+// Locks in the constructor and unlocks in the destructor like
+// std::unique_lock, with lock()/unlock() in between. An acquisition that
+// try_lock() can't get straight away counts as contended and its wait is
+// timed; the hold is timed from acquisition to unlock().
+template <typename Mutex, typename Ops>
+class basic_lock {
+public:
+  typedef Mutex mutex_type;
+  typedef std::chrono::steady_clock clock;
+
+  explicit basic_lock(Mutex& m, const char* function = __builtin_FUNCTION(),
+                      const char* file = __builtin_FILE(), unsigned line = __builtin_LINE())
+    : m_(&m), stats_(registry::instance().local(site{function, file, line, Ops::kind})), owns_(false) {
+    lock();
+  }
+  basic_lock(const basic_lock&) = delete;
+  basic_lock& operator=(const basic_lock&) = delete;
+
+  ~basic_lock() {
+    if (owns_)
+      unlock();
+  }
+
+  void lock() {
+    if (Ops::try_lock(*m_)) {
+      acquired_ = clock::now();
+      stats_.acquired(0, false);
+    } else {
+      const clock::time_point t0 = clock::now();
+      Ops::lock(*m_);
+      acquired_ = clock::now();
+      stats_.acquired(ns(acquired_ - t0), true);
+    }
+    owns_ = true;
+  }
+
+  void unlock() {
+    const clock::time_point released = clock::now();
+    Ops::unlock(*m_);
+    owns_ = false;
+    stats_.released(ns(released - acquired_));
+  }
+
+  bool owns_lock() const { return owns_; }
+  explicit operator bool() const { return owns_; }
+  Mutex* mutex() const { return m_; }
+
+private:
+  static std::uint64_t ns(clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+
+  Mutex* m_;
+  site_stats& stats_;
+  bool owns_;
+  clock::time_point acquired_;
+};
+
+} // namespace detail
+
+// Instrumented stand-ins for std::unique_lock / boost::unique_lock,
+// std::shared_lock / boost::shared_lock and std::lock_guard
+template <typename Mutex> using unique_lock = detail::basic_lock<Mutex, detail::exclusive_ops>;
+template <typename Mutex> using shared_lock = detail::basic_lock<Mutex, detail::shared_ops>;
+template <typename Mutex> using lock_guard = detail::basic_lock<Mutex, detail::exclusive_ops>;
+
+inline void dump(std::ostream& os) { registry::instance().dump(os); }
+
+} // namespace lock_stats
+
+#endif // LOCK_STATS
+
+#endif // LOCK_STATS_HPP
@@ -0,0 +1,106 @@
+#ifndef CHANGE_NOTIFIER_HPP
+#define CHANGE_NOTIFIER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__linux__)
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# include <climits>
+# include <ctime>
+#else
+# include <condition_variable>
+# include <mutex>
+#endif
+
+namespace stackoverflow {
+
+// Monotonic version counter that threads can sleep on. Writers call bump()
+// after they change something; readers remember the version they last saw
+// and wait_for_change() until it moves. Waiting doesn't hold any lock, and
+// bump() only makes a syscall when someone is actually waiting.
+//
+// On Linux waiters sleep on a futex. Elsewhere they fall back to a
+// condition variable, which only writers with waiters ever lock.
+class ChangeNotifier final {
+public:
+  typedef std::uint64_t version_t;
+
+  ChangeNotifier() : version_(0), futex_(0), waiters_(0) {}
+  ChangeNotifier(const ChangeNotifier&) = delete;
+  ChangeNotifier& operator=(const ChangeNotifier&) = delete;
+
+  version_t version() const { return version_.load(std::memory_order_acquire); }
+
+  // Callers are serialized (Example holds its unique lock), so this doesn't
+  // need to be an atomic read-modify-write on version_.
+  void bump() {
+    version_.store(version_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    futex_.fetch_add(1, std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_seq_cst) == 0)
+      return;
+#if defined(__linux__)
+    ::syscall(SYS_futex, &futex_, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+    std::lock_guard<std::mutex> lk(mtx_);
+    cv_.notify_all();
+#endif
+  }
+
+  // Returns the new version, or last_seen if timeout passed first.
+  version_t wait_for_change(const version_t last_seen, const std::chrono::nanoseconds timeout) const {
+    version_t v = version();
+    if (v != last_seen)
+      return v;
+
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    for (;;) {
+      // Read the futex word before re-checking the version: if bump() ran
+      // after this load, the kernel sees a different word and doesn't sleep.
+      const std::uint32_t word = futex_.load(std::memory_order_seq_cst);
+      v = version();
+      if (v != last_seen)
+        break;
+
+      const std::chrono::nanoseconds left = deadline - std::chrono::steady_clock::now();
+      if (left <= std::chrono::nanoseconds::zero())
+        break;
+      sleep(word, left);
+    }
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return v;
+  }
+
+private:
+  void sleep(const std::uint32_t word, const std::chrono::nanoseconds left) const {
+#if defined(__linux__)
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(left.count() / 1000000000);
+    ts.tv_nsec = static_cast<long>(left.count() % 1000000000);
+    ::syscall(SYS_futex, &futex_, FUTEX_WAIT_PRIVATE, word, &ts, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lk(mtx_);
+    if (futex_.load(std::memory_order_seq_cst) == word)
+      cv_.wait_for(lk, left);
+#endif
+  }
+
+  std::atomic<version_t> version_;
+
+  // Low 32 bits of the change count, which is all a futex can wait on
+  mutable std::atomic<std::uint32_t> futex_;
+  mutable std::atomic<unsigned> waiters_;
+
+#if !defined(__linux__)
+  mutable std::mutex mtx_;
+  mutable std::condition_variable cv_;
+#endif
+};
+
+} // namespace stackoverflow
+
+#endif // CHANGE_NOTIFIER_HPP
@@ -1,180 +1,507 @@
 #include "example.hpp"
 
 #include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <new>
 #include <utility>
 
-namespace stackoverflow {
-
-class Example;
-class Example::Impl;
-
+#if EXAMPLE_SEQLOCK_BAR
+# include <atomic>
+#endif
 
-#if !defined(_MSC_VER) || _MSC_VER > 1600
-// Congratulations!, you're using a compiler that isn't broken
+#include "change_notifier.hpp"
+#include "example_snapshot.hpp"
+#include "simd_bytes.hpp"
 
-// Explicitly instantiate std::string variants
-template bool Example::foo_set<std::string>(std::string&& src);
-template bool Example::foo_set<std::string&>(std::string& src);
-template bool Example::foo_set<const std::string&>(const std::string& src);
+namespace stackoverflow {
 
-// The following isn't required because of the array Example::foo_set()
-// specialization, but I'm leaving it here for reference.
-//
-// template bool Example::foo_set<const char(&)[7]>(char const (&)[7]);
-#else
-// MSVC workaround: msvc_rage_hate() isn't ever called, but use it to
-// instantiate all of the required templates.
+#if EXAMPLE_SEQLOCK_BAR
 namespace {
-  void msvc_rage_hate() {
-    Example e;
-    const std::string a_const_str("a");
-    std::string a_str("b");
-    e.foo_set(a_const_str);
-    e.foo_set(a_str);
-    e.foo_set("c");
-    e.foo_set(std::string("d"));
+  // Spin-wait hint while a seqlock writer is active
+  inline void cpu_relax() {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
   }
 } // anon namespace
-#endif // _MSC_VER
+#endif
+
+
 
 
 
 // Example Private Implementation
 
-class Example::Impl final {
+class ExampleImpl final {
 public:
+  typedef std::shared_ptr<const std::string> foo_snapshot_t;
+
   // ctors && obj boilerplate
-  Impl();
-  Impl(const std::string& init_foo);
-  ~Impl() = default;
-  Impl(const Impl&) = delete;
-  Impl& operator=(const Impl&) = delete;
+  ExampleImpl();
+  ExampleImpl(const std::string& init_foo);
+  ExampleImpl(const ExampleSnapshotRecord& rec);
+  ~ExampleImpl() = default;
+  ExampleImpl(const ExampleImpl&) = delete;
+  ExampleImpl& operator=(const ExampleImpl&) = delete;
 
   // Use a template because we don't care which Lockable concept or LockType
   // is being used, just so long as a lock is held.
   template <typename LockType>
   bool bar(LockType& lk, std::size_t len, char* dst) const;
 
+#if EXAMPLE_SEQLOCK_BAR
+  // Lock-free read of bar_, see bar_seq_
+  bool bar(std::size_t len, char* dst) const;
+#endif
+
   template <typename LockType>
   std::size_t bar_capacity(LockType& lk) const;
 
   // bar_set() requires a unique lock
-  bool bar_set(unique_lock_t& lk, const std::size_t len, const char* src);
+  template <typename UniqueLockType>
+  bool bar_set(UniqueLockType& lk, const std::size_t len, const char* src);
 
   template <typename LockType>
   std::string foo(LockType& lk) const;
 
-  template <typename T>
-  bool foo_set(unique_lock_t& lk, T&& src);
+  template <typename UniqueLockType, typename T>
+  bool foo_set(UniqueLockType& lk, T&& src);
+
+  // Copies src in to foo_'s existing buffer rather than replacing it
+  template <typename UniqueLockType>
+  bool foo_set(UniqueLockType& lk, boost::string_view src);
+
+  // Returns an empty snapshot if one has never been published
+  foo_snapshot_t foo_snapshot() const;
+
+  // No lock needed for either, see ChangeNotifier
+  ChangeNotifier::version_t version() const { return changes_.version(); }
+  ChangeNotifier::version_t wait_for_change(const ChangeNotifier::version_t last_seen,
+                                            const std::chrono::nanoseconds timeout) const {
+    return changes_.wait_for_change(last_seen, timeout);
+  }
+
+  template <typename LockType>
+  void snapshot(LockType& lk, ExampleSnapshotWriter& w, boost::string_view key) const;
+
+  // Publish foo_ for foo_snapshot(). Any lock will do: writers also publish
+  // while they hold the unique lock, so foo_ can't change underneath us.
+  template <typename LockType>
+  foo_snapshot_t foo_snapshot_publish(LockType& lk) const;
 
 private:
   // Example datatype that supports rvalue references
   std::string foo_;
 
+  // Set instead of foo_ by a snapshot restore: foo's length and bytes in
+  // the snapshot's mapping (see ExampleSnapshotRecord::foo_ref()). Dropped,
+  // along with this object's hold on the mapping, the first time foo_ is
+  // set.
+  std::shared_ptr<const char> foo_mapped_;
+
+  boost::string_view foo_view() const {
+    return foo_mapped_ ? ExampleSnapshotRecord::foo_of(foo_mapped_.get()) : boost::string_view(foo_);
+  }
+
+  // Copy of foo_ for readers that don't take rw_mtx_. Only ever accessed
+  // through std::atomic_load()/std::atomic_store(), and stays null until
+  // someone calls foo_snapshot() so writers don't allocate a copy nobody
+  // reads.
+  mutable foo_snapshot_t foo_snap_;
+
+  // Bumped by foo_set(), which bar_set() goes through, whenever foo_ changes
+  ChangeNotifier changes_;
+
+  // foo_ == src, a vector at a time
+  bool foo_equals(boost::string_view src) const {
+    const boost::string_view foo = foo_view();
+    return foo.size() == src.size() && simd_bytes::equal(foo.data(), src.data(), src.size());
+  }
+
   // Example POD datatype that doesn't support rvalue
-  static const std::size_t bar_capacity_ = 16;
+  static constexpr std::size_t bar_capacity_ = EXAMPLE_BAR_CAPACITY;
+
+#if EXAMPLE_SEQLOCK_BAR
+  // bar_ is read without the lock, so it's stored as relaxed atomic words
+  // rather than a char[] (a plain memcpy racing with a writer is a data
+  // race, even if the seqlock throws the result away). bar_seq_ is odd
+  // while a writer is in the middle of updating bar_.
+  typedef std::uint64_t bar_word_t;
+  static const std::size_t bar_words_ =
+    (bar_capacity_ + sizeof(bar_word_t) - 1) / sizeof(bar_word_t);
+
+  void bar_store(const std::size_t len, const char* src);
+
+  std::atomic<unsigned> bar_seq_;
+  std::atomic<bar_word_t> bar_[bar_words_];
+#else
   char bar_[bar_capacity_ + 1];
+#endif
 };
 
 // Example delegating ctor
-Example::Impl::Impl() : Impl("default foo value") {}
-
-Example::Impl::Impl(const std::string& init_foo) : foo_{init_foo} {
+ExampleImpl::ExampleImpl() : ExampleImpl("default foo value") {}
+
+#if EXAMPLE_SEQLOCK_BAR
+ExampleImpl::ExampleImpl(const std::string& init_foo) : foo_{init_foo}, bar_seq_{0} {
+  char init[bar_words_ * sizeof(bar_word_t)];
+  std::memset(init, 99 /* ASCII 'c' */, sizeof(init));
+  for (std::size_t i = 0; i < bar_words_; ++i) {
+    bar_word_t w;
+    std::memcpy(&w, init + i * sizeof(w), sizeof(w));
+    bar_[i].store(w, std::memory_order_relaxed);
+  }
+}
+#else
+ExampleImpl::ExampleImpl(const std::string& init_foo) : foo_{init_foo} {
   std::memset(bar_, 99 /* ASCII 'c' */, bar_capacity_);
   bar_[bar_capacity_] = '\0'; // null padding
 }
+#endif
+
+ExampleImpl::ExampleImpl(const ExampleSnapshotRecord& rec) : ExampleImpl(std::string()) {
+  foo_mapped_ = rec.foo_ref();
+  if (!foo_mapped_)
+    foo_.assign(rec.foo().data(), rec.foo().size());
+
+  // Nobody else can see this object yet, so there's no lock to take
+  const boost::string_view bar = rec.bar();
+  const std::size_t len = std::min(bar.size(), bar_capacity_);
+#if EXAMPLE_SEQLOCK_BAR
+  bar_store(len, bar.data());
+#else
+  std::memcpy(bar_, bar.data(), len);
+#endif
+}
 
 
 template <typename LockType>
 bool
-Example::Impl::bar(LockType& lk, const std::size_t len, char* dst) const {
+ExampleImpl::bar(LockType& lk, const std::size_t len, char* dst) const {
   BOOST_ASSERT(lk.owns_lock());
-  if (len != bar_capacity(lk))
+#if EXAMPLE_SEQLOCK_BAR
+  return bar(len, dst);
+#else
+  if (len > bar_capacity(lk))
     return false;
-  std::memcpy(dst, bar_, len);
+  simd_bytes::copy(dst, bar_, len);
 
   return true;
+#endif
 }
 
 
+#if EXAMPLE_SEQLOCK_BAR
+bool
+ExampleImpl::bar(const std::size_t len, char* dst) const {
+  if (len > bar_capacity_)
+    return false;
+
+  // Copy bar_ and retry if a writer was active at any point during the copy.
+  // Readers only ever load, so they don't bounce a cache line between each
+  // other the way a shared_mutex's reader count does.
+  unsigned seq0, seq1;
+  do {
+    seq0 = bar_seq_.load(std::memory_order_acquire);
+    while (seq0 & 1) {
+      cpu_relax();
+      seq0 = bar_seq_.load(std::memory_order_acquire);
+    }
+
+    // Relaxed atomic loads can't be vectorized, so this goes a word at a
+    // time regardless of simd_bytes.
+    for (std::size_t off = 0; off < len; off += sizeof(bar_word_t)) {
+      const bar_word_t w = bar_[off / sizeof(bar_word_t)].load(std::memory_order_relaxed);
+      std::memcpy(dst + off, &w, std::min(sizeof(w), len - off));
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    seq1 = bar_seq_.load(std::memory_order_relaxed);
+  } while (seq0 != seq1);
+
+  return true;
+}
+
+
+// Caller holds the unique lock, so there's exactly one writer and bar_ can be
+// read back without any seqlock dance.
+void
+ExampleImpl::bar_store(const std::size_t len, const char* src) {
+  const unsigned seq = bar_seq_.load(std::memory_order_relaxed);
+  bar_seq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (std::size_t off = 0; off < len; off += sizeof(bar_word_t)) {
+    std::atomic<bar_word_t>& dst = bar_[off / sizeof(bar_word_t)];
+    bar_word_t w = dst.load(std::memory_order_relaxed);
+    std::memcpy(&w, src + off, std::min(sizeof(w), len - off));
+    dst.store(w, std::memory_order_relaxed);
+  }
+
+  bar_seq_.store(seq + 2, std::memory_order_release);
+}
+#endif
+
+
 template <typename LockType>
 std::size_t
-Example::Impl::bar_capacity(LockType& lk) const {
+ExampleImpl::bar_capacity(LockType& lk) const {
   BOOST_ASSERT(lk.owns_lock());
-  return Impl::bar_capacity_;
+  return bar_capacity_;
 }
 
 
+template <typename UniqueLockType>
 bool
-Example::Impl::bar_set(unique_lock_t &lk, const std::size_t len, const char* src) {
+ExampleImpl::bar_set(UniqueLockType& lk, const std::size_t len, const char* src) {
   BOOST_ASSERT(lk.owns_lock());
 
   // Return false if len is bigger than bar_capacity or the values are
   // identical
-  if (len > bar_capacity(lk) || foo(lk) == src)
+  const boost::string_view val(src, len);
+  if (len > bar_capacity(lk) || foo_equals(val))
     return false;
 
   // Copy src to bar_, a side effect of updating foo_ if they're different
-  std::memcpy(bar_, src, std::min(len, bar_capacity(lk)));
-  foo_set(lk, std::string(src, len));
+#if EXAMPLE_SEQLOCK_BAR
+  bar_store(len, src);
+#else
+  simd_bytes::copy(bar_, src, len);
+#endif
+  foo_set(lk, val);
   return true;
 }
 
 
 template <typename LockType>
 std::string
-Example::Impl::foo(LockType& lk) const {
+ExampleImpl::foo(LockType& lk) const {
   BOOST_ASSERT(lk.owns_lock());
-  return foo_;
+  return foo_mapped_ ? std::string(foo_view()) : foo_;
 }
 
 
-template <typename T>
+template <typename UniqueLockType, typename T>
 bool
-Example::Impl::foo_set(unique_lock_t &lk, T&& src) {
+ExampleImpl::foo_set(UniqueLockType& lk, T&& src) {
   BOOST_ASSERT(lk.owns_lock());
-  if (foo_ == src) return false;
+  if (foo_view() == src) return false;
   foo_ = std::move(src);
+  foo_mapped_.reset();
+
+  // Writers are serialized by lk, so reading foo_snap_ without
+  // atomic_load() is safe: the only other accesses are loads.
+  if (foo_snap_)
+    foo_snapshot_publish(lk);
+  changes_.bump();
   return true;
 }
 
 
+template <typename UniqueLockType>
+bool
+ExampleImpl::foo_set(UniqueLockType& lk, boost::string_view src) {
+  BOOST_ASSERT(lk.owns_lock());
+  if (foo_equals(src)) return false;
+
+  // assign() only reallocates if src doesn't fit in foo_'s capacity
+  foo_.assign(src.data(), src.size());
+  foo_mapped_.reset();
+
+  if (foo_snap_)
+    foo_snapshot_publish(lk);
+  changes_.bump();
+  return true;
+}
+
+
+ExampleImpl::foo_snapshot_t
+ExampleImpl::foo_snapshot() const {
+  // Not lock-free: a short critical section on one of the library's
+  // internal mutexes, see BasicExample::foo_snapshot()
+  return std::atomic_load(&foo_snap_);
+}
+
+
+template <typename LockType>
+ExampleImpl::foo_snapshot_t
+ExampleImpl::foo_snapshot_publish(LockType& lk) const {
+  BOOST_ASSERT(lk.owns_lock());
+  foo_snapshot_t snap = foo_mapped_ ? std::make_shared<const std::string>(foo_view())
+                                    : std::make_shared<const std::string>(foo_);
+  // Same internal mutex as atomic_load(), held for the pointer swap only
+  std::atomic_store(&foo_snap_, snap);
+  return snap;
+}
+
+
+template <typename LockType>
+void
+ExampleImpl::snapshot(LockType& lk, ExampleSnapshotWriter& w, boost::string_view key) const {
+  BOOST_ASSERT(lk.owns_lock());
+  char bar[bar_capacity_];
+#if EXAMPLE_SEQLOCK_BAR
+  this->bar(bar_capacity_, bar);
+#else
+  std::memcpy(bar, bar_, bar_capacity_);
+#endif
+  w.add(key, foo_view(), bar, bar_capacity_);
+}
+
+
 // Example Public Interface
 
-Example::Example() : impl_(new Impl{}) {}
-Example::Example(const std::string& init_foo) : impl_(new Impl{init_foo}) {}
-Example::~Example() = default;
+#if EXAMPLE_INLINE_IMPL
+static_assert(sizeof(ExampleImpl) <= EXAMPLE_IMPL_SIZE,
+              "ExampleImpl doesn't fit in its inline storage, raise EXAMPLE_IMPL_SIZE");
+static_assert(alignof(ExampleImpl) <= EXAMPLE_IMPL_ALIGN,
+              "ExampleImpl needs more alignment than EXAMPLE_IMPL_ALIGN");
+
+template <typename LockPolicy>
+BasicExample<LockPolicy>::BasicExample() { new (&impl_storage_) Impl{}; }
+
+template <typename LockPolicy>
+BasicExample<LockPolicy>::BasicExample(const std::string& init_foo) { new (&impl_storage_) Impl{init_foo}; }
+
+template <typename LockPolicy>
+BasicExample<LockPolicy>::BasicExample(const ExampleSnapshotRecord& rec) { new (&impl_storage_) Impl{rec}; }
+
+template <typename LockPolicy>
+BasicExample<LockPolicy>::~BasicExample() { impl()->~Impl(); }
+#else
+template <typename LockPolicy>
+BasicExample<LockPolicy>::BasicExample() : impl_(new Impl{}) {}
+
+template <typename LockPolicy>
+BasicExample<LockPolicy>::BasicExample(const std::string& init_foo) : impl_(new Impl{init_foo}) {}
+
+template <typename LockPolicy>
+BasicExample<LockPolicy>::BasicExample(const ExampleSnapshotRecord& rec) : impl_(new Impl{rec}) {}
+
+template <typename LockPolicy>
+BasicExample<LockPolicy>::~BasicExample() = default;
+#endif
 
+template <typename LockPolicy>
 bool
-Example::bar(const std::size_t len, char* dst) const {
+BasicExample<LockPolicy>::bar(const std::size_t len, char* dst) const {
+#if EXAMPLE_SEQLOCK_BAR
+  return impl()->bar(len, dst);
+#else
   shared_lock_t lk(rw_mtx_);
-  return impl_->bar(lk, len , dst);
+  return impl()->bar(lk, len , dst);
+#endif
 }
 
+template <typename LockPolicy>
 std::size_t
-Example::bar_capacity() const {
+BasicExample<LockPolicy>::bar_capacity() const {
   shared_lock_t lk(rw_mtx_);
-  return impl_->bar_capacity(lk);
+  return impl()->bar_capacity(lk);
 }
 
+template <typename LockPolicy>
 bool
-Example::bar_set(const std::size_t len, const char* src) {
+BasicExample<LockPolicy>::bar_set(const std::size_t len, const char* src) {
   unique_lock_t lk(rw_mtx_);
-  return impl_->bar_set(lk, len, src);
+  return impl()->bar_set(lk, len, src);
 }
 
+template <typename LockPolicy>
 std::string
-Example::foo() const {
+BasicExample<LockPolicy>::foo() const {
+  shared_lock_t lk(rw_mtx_);
+  return impl()->foo(lk);
+}
+
+template <typename LockPolicy>
+typename BasicExample<LockPolicy>::foo_snapshot_t
+BasicExample<LockPolicy>::foo_snapshot() const {
+  foo_snapshot_t snap = impl()->foo_snapshot();
+  if (snap)
+    return snap;
+
+  // First reader. Racing first readers each publish an identical copy,
+  // which is harmless, and the shared lock keeps writers out meanwhile.
   shared_lock_t lk(rw_mtx_);
-  return impl_->foo(lk);
+  return impl()->foo_snapshot_publish(lk);
+}
+
+template <typename LockPolicy>
+template <typename T>
+bool
+BasicExample<LockPolicy>::foo_set(T&& src) {
+  unique_lock_t lk(rw_mtx_);
+  return impl()->foo_set(lk, std::forward<T>(src));
 }
 
-template<typename T>
+template <typename LockPolicy>
 bool
-Example::foo_set(T&& src) {
+BasicExample<LockPolicy>::foo_set(boost::string_view src) {
   unique_lock_t lk(rw_mtx_);
-  return impl_->foo_set(lk, std::forward<T>(src));
+  return impl()->foo_set(lk, src);
+}
+
+template <typename LockPolicy>
+typename BasicExample<LockPolicy>::version_t
+BasicExample<LockPolicy>::version() const {
+  return impl()->version();
+}
+
+template <typename LockPolicy>
+typename BasicExample<LockPolicy>::version_t
+BasicExample<LockPolicy>::wait_for_change(const version_t last_seen,
+                                          const std::chrono::nanoseconds timeout) const {
+  return impl()->wait_for_change(last_seen, timeout);
+}
+
+template <typename LockPolicy>
+void
+BasicExample<LockPolicy>::snapshot(ExampleSnapshotWriter& w, boost::string_view key) const {
+  shared_lock_t lk(rw_mtx_);
+  impl()->snapshot(lk, w, key);
 }
 
+
+#if !defined(_MSC_VER) || _MSC_VER > 1600
+// Congratulations!, you're using a compiler that isn't broken
+
+// Explicitly instantiate each lock policy along with its std::string
+// variants of foo_set()
+#define EXAMPLE_INSTANTIATE(Policy)                                       \
+  template class BasicExample<Policy>;                                    \
+  template bool BasicExample<Policy>::foo_set<std::string>(std::string&& src); \
+  template bool BasicExample<Policy>::foo_set<std::string&>(std::string& src); \
+  template bool BasicExample<Policy>::foo_set<const std::string&>(const std::string& src)
+
+// To plug in another lock policy, add a line for it here.
+
+EXAMPLE_INSTANTIATE(BoostLockPolicy);
+#if EXAMPLE_STD_LOCK_POLICY
+EXAMPLE_INSTANTIATE(StdLockPolicy);
+#endif
+EXAMPLE_INSTANTIATE(DistributedLockPolicy);
+
+// The following isn't required because of the array Example::foo_set()
+// specialization, but I'm leaving it here for reference.
+//
+// template bool Example::foo_set<const char(&)[7]>(char const (&)[7]);
+#else
+// MSVC workaround: msvc_rage_hate() isn't ever called, but use it to
+// instantiate all of the required templates. Only the default policy is
+// covered here.
+namespace {
+  void msvc_rage_hate() {
+    Example e;
+    const std::string a_const_str("a");
+    std::string a_str("b");
+    e.foo_set(a_const_str);
+    e.foo_set(a_str);
+    e.foo_set("c");
+    e.foo_set(std::string("d"));
+  }
+} // anon namespace
+#endif // _MSC_VER
+
 } // namespace stackoverflow
@@ -1,44 +1,131 @@
 #ifndef EXAMPLE_HPP
 #define EXAMPLE_HPP
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <type_traits>
 
-#ifndef BOOST_THREAD_SHARED_MUTEX_HPP
-# include <boost/thread/shared_mutex.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include "lock_policy.hpp"
+
+// When non-zero, bar() doesn't touch rw_mtx_ at all: Impl guards bar_ with a
+// sequence lock so readers never write to shared memory and only retry if a
+// bar_set() ran while they were copying. Writers still take the unique lock,
+// so bar_set() continues to update bar_ and foo_ together. Build with
+// -DEXAMPLE_SEQLOCK_BAR=0 to go back to the shared lock.
+#ifndef EXAMPLE_SEQLOCK_BAR
+# define EXAMPLE_SEQLOCK_BAR 1
+#endif
+
+// Where Impl lives. With EXAMPLE_INLINE_IMPL (the default) it's constructed
+// in EXAMPLE_IMPL_SIZE bytes of storage inside the Example itself, which
+// saves a heap allocation per object and a dependent load per call. Impl's
+// definition is still private to example.cpp, which static_asserts that it
+// fits; if it doesn't, raise EXAMPLE_IMPL_SIZE. Build with
+// -DEXAMPLE_INLINE_IMPL=0 to allocate Impl separately through a
+// unique_ptr. Either way every translation unit has to agree.
+#ifndef EXAMPLE_INLINE_IMPL
+# define EXAMPLE_INLINE_IMPL 1
+#endif
+
+// Size of bar in bytes. bar() reads up to this many, bar_set() writes up to
+// this many. Every translation unit has to agree on it.
+#ifndef EXAMPLE_BAR_CAPACITY
+# define EXAMPLE_BAR_CAPACITY 16
+#endif
+
+#ifndef EXAMPLE_IMPL_SIZE
+# define EXAMPLE_BAR_STORAGE ((EXAMPLE_BAR_CAPACITY + 8) / 8 * 8)
+# if defined(__linux__)
+#  define EXAMPLE_IMPL_SIZE (88 + EXAMPLE_BAR_STORAGE)
+# else
+   // Room for ChangeNotifier's mutex and condition variable
+#  define EXAMPLE_IMPL_SIZE (248 + EXAMPLE_BAR_STORAGE)
+# endif
+#endif
+
+#ifndef EXAMPLE_IMPL_ALIGN
+# define EXAMPLE_IMPL_ALIGN 8
 #endif
 
 namespace stackoverflow {
 
-class Example final {
+// Private implementation shared by every lock policy. Its accessors are
+// templated on the lock type, so it doesn't care which mutex is held, just
+// that one is.
+class ExampleImpl;
+
+// See example_snapshot.hpp
+class ExampleSnapshotRecord;
+class ExampleSnapshotWriter;
+
+// The lock is a policy (see lock_policy.hpp) so that the read-side cost can
+// be picked per use case. The definitions live in example.cpp, which
+// explicitly instantiates the policies shipped in lock_policy.hpp; another
+// policy needs its own instantiation line at the bottom of example.cpp.
+template <typename LockPolicy>
+class BasicExample final {
 public:
-  typedef ::boost::shared_mutex shared_mtx_t;
-  typedef ::boost::shared_lock< shared_mtx_t > shared_lock_t;
-  typedef ::boost::unique_lock< shared_mtx_t > unique_lock_t;
+  typedef typename LockPolicy::shared_mtx_t shared_mtx_t;
+  typedef typename LockPolicy::shared_lock_t shared_lock_t;
+  typedef typename LockPolicy::unique_lock_t unique_lock_t;
+
+  // Immutable, reference counted version of foo. Holding on to one keeps
+  // that version alive no matter how many times foo_set() is called.
+  typedef std::shared_ptr<const std::string> foo_snapshot_t;
 
-  Example();
-  Example(const std::string& initial_foo);
+  typedef std::uint64_t version_t;
 
-  ~Example();
-  Example(const Example&) = delete;             // Prevent copying
-  Example& operator=(const Example&) = delete;  // Prevent assignment
+  BasicExample();
+  BasicExample(const std::string& initial_foo);
+
+  // Warm restart from a snapshot (see example_snapshot.hpp). bar is copied
+  // out of rec; a large foo stays in the mapping, which this object keeps
+  // alive, until foo_set() or bar_set() replaces it.
+  explicit BasicExample(const ExampleSnapshotRecord& rec);
+
+  ~BasicExample();
+  BasicExample(const BasicExample&) = delete;             // Prevent copying
+  BasicExample& operator=(const BasicExample&) = delete;  // Prevent assignment
 
   // Example getter method that supports rvalues
   std::string foo() const;
 
+  // Read-mostly getter for foo: no rw_mtx_ and no copy of the string, just
+  // a reference count bump on the current version. That isn't lock-free:
+  // the shared_ptr atomics take a short internal lock (libstdc++ hashes
+  // the pointer's address in to a small pool of mutexes), but it's held
+  // for the bump and not for as long as a copy, and readers never wait
+  // behind a writer holding rw_mtx_. Setters publish a new
+  // version and readers holding an old one keep it until they let go (i.e.
+  // RCU with shared_ptr doing the reclamation). Only the very first call on
+  // an Example takes the shared lock, to publish the initial version;
+  // until then foo_set() doesn't pay for publishing at all.
+  foo_snapshot_t foo_snapshot() const;
+
   // Example setter method using perfect forwarding & move semantics. Anything
   // that's std::string-like will work as a parameter.
   template<typename T>
   bool foo_set(T&& new_val);
 
+  // Allocation-free setter: compares new_val against foo and copies it in
+  // to foo's existing buffer, so once foo has grown to fit, an update
+  // doesn't touch the heap (unless foo_snapshot() is in use, which needs a
+  // new version per update). The C string overloads below funnel in to
+  // this one instead of building a temporary std::string.
+  bool foo_set(boost::string_view new_val);
+
   // Begin foo_set() variants required to deal with C types (e.g. char[],
   // char*). The rest of the foo_set() methods here are *NOT* required under
   // normal circumstances.
 
   // Setup a specialization for const char[] that simply forwards along a
-  // std::string. This is preferred over having to explicitly instantiate a
+  // string_view. This is preferred over having to explicitly instantiate a
   // bunch of const char[N] templates or possibly std::decay a char[] to a
-  // char* (i.e. using a std::string as a container is a Good Thing(tm)).
+  // char*.
   //
   // Also, without this, it is required to explicitly instantiate the required
   // variants of const char[N] someplace. For example, in example.cpp:
@@ -48,38 +135,75 @@ public:
   // template bool Example::foo_set<const char(&)[8]>(char const (&)[8]);
   // ...
   //
-  // Eww. Best to just forward to wrap new_val in a std::string and proxy
-  // along the call to foo_set<std::string>().
+  // Eww. A string literal's trailing NUL isn't part of the value, so it's
+  // dropped here.
   template<std::size_t N>
-  bool foo_set(const char (&new_val)[N]) { return foo_set(std::string(new_val, N)); }
+  bool foo_set(const char (&new_val)[N]) {
+    return foo_set(boost::string_view(new_val, N - (N > 0 && new_val[N - 1] == '\0')));
+  }
 
   // Inline function overloads to support null terminated char* && const
   // char* arguments. If there's a way to reduce this duplication with
   // templates, I'm all ears because I wasn't able to generate a templated
   // versions that didn't conflict with foo_set<T&&>().
-  bool foo_set(char* new_val)       { return foo_set(std::string(new_val)); }
-  bool foo_set(const char* new_val) { return foo_set(std::string(new_val)); }
+  bool foo_set(char* new_val)       { return foo_set(boost::string_view(new_val)); }
+  bool foo_set(const char* new_val) { return foo_set(boost::string_view(new_val)); }
 
   // End of the foo_set() overloads.
 
-  // Example getter method for a POD data type
+  // Example getter method for a POD data type. Copies the first len bytes of
+  // bar (len <= bar_capacity()) in to dst. Lock-free when
+  // EXAMPLE_SEQLOCK_BAR is set.
   bool bar(const std::size_t len, char* dst) const;
   std::size_t bar_capacity() const;
 
   // Example setter that uses a unique lock to access foo()
   bool bar_set(const std::size_t len, const char* src);
 
+  // Change notification instead of polling foo(). version() goes up by one
+  // every time foo_set() or bar_set() actually changes a value (setting the
+  // same value again doesn't count). wait_for_change() sleeps, without
+  // holding rw_mtx_, until the version differs from last_seen or timeout
+  // passes, and returns the version it saw (last_seen on a timeout).
+  //
+  //   version_t v = e.version();
+  //   for (;;) {
+  //     std::string foo = e.foo();
+  //     ...
+  //     v = e.wait_for_change(v, std::chrono::seconds(1));
+  //   }
+  version_t version() const;
+  version_t wait_for_change(const version_t last_seen, const std::chrono::nanoseconds timeout) const;
+
+  // Adds foo and bar to w as one record, stored under key. The shared lock
+  // is held only while they're copied in to w's buffer.
+  void snapshot(ExampleSnapshotWriter& w, boost::string_view key = boost::string_view()) const;
+
   // Question #1: I can't find any harm in making Impl public because the
   // definition is opaque. Making Impl public, however, greatly helps with
   // implementing Example, which does have access to Example::Impl's
   // interface. This is also preferre, IMO, over using friend.
-  class Impl;
+  typedef ExampleImpl Impl;
 
 private:
   mutable shared_mtx_t rw_mtx_;
+
+#if EXAMPLE_INLINE_IMPL
+  Impl* impl() const {
+    return reinterpret_cast<Impl*>(const_cast<impl_storage_t*>(&impl_storage_));
+  }
+
+  typedef typename std::aligned_storage<EXAMPLE_IMPL_SIZE, EXAMPLE_IMPL_ALIGN>::type impl_storage_t;
+  impl_storage_t impl_storage_;
+#else
+  Impl* impl() const { return impl_.get(); }
+
   std::unique_ptr<Impl> impl_;
+#endif
 };
 
+typedef BasicExample<BoostLockPolicy> Example;
+
 } // namespace stackoverflow
 
 #endif // EXAMPLE_HPP
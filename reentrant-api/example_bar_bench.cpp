@@ -0,0 +1,107 @@
+// Compares simd_bytes' equality and copy implementations with each other
+// and with memcmp()/memcpy() across buffer sizes, i.e. what bar_set() costs
+// for a given EXAMPLE_BAR_CAPACITY. Prints nanoseconds per call.
+
+#include <sysexits.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "simd_bytes.hpp"
+
+namespace {
+
+namespace sb = stackoverflow::simd_bytes;
+typedef std::chrono::steady_clock bench_clock;
+
+typedef bool (*equal_fn)(const char*, const char*, std::size_t);
+typedef void (*copy_fn)(char*, const char*, std::size_t);
+
+bool equal_memcmp(const char* a, const char* b, std::size_t n) { return std::memcmp(a, b, n) == 0; }
+void copy_memcpy(char* dst, const char* src, std::size_t n) { std::memcpy(dst, src, n); }
+
+// Enough calls per measurement to get well past the clock's resolution
+std::size_t
+iterations(std::size_t size) {
+  return std::max<std::size_t>(1000, (64u << 20) / size);
+}
+
+double
+time_equal(equal_fn fn, const char* a, const char* b, std::size_t n) {
+  const std::size_t iters = iterations(n);
+  std::size_t hits = 0;
+  const bench_clock::time_point t0 = bench_clock::now();
+  for (std::size_t i = 0; i < iters; ++i) {
+    // Keep the compiler from hoisting the call out of the loop
+    asm volatile("" : : "r"(a), "r"(b) : "memory");
+    hits += fn(a, b, n);
+  }
+  const bench_clock::time_point t1 = bench_clock::now();
+  if (hits != iters)
+    std::cerr << "equal() returned false\n";
+  return std::chrono::duration<double, std::nano>(t1 - t0).count() / iters;
+}
+
+double
+time_copy(copy_fn fn, char* dst, const char* src, std::size_t n) {
+  const std::size_t iters = iterations(n);
+  const bench_clock::time_point t0 = bench_clock::now();
+  for (std::size_t i = 0; i < iters; ++i) {
+    asm volatile("" : : "r"(dst), "r"(src) : "memory");
+    fn(dst, src, n);
+  }
+  const bench_clock::time_point t1 = bench_clock::now();
+  if (std::memcmp(dst, src, n) != 0)
+    std::cerr << "copy() didn't copy\n";
+  return std::chrono::duration<double, std::nano>(t1 - t0).count() / iters;
+}
+
+struct variant {
+  const char* name;
+  equal_fn equal;
+  copy_fn copy;
+};
+
+} // anon namespace
+
+
+int
+main(const int /*argc*/, const char** /*argv*/) {
+  std::vector<variant> variants;
+  variants.push_back(variant{"libc", &equal_memcmp, &copy_memcpy});
+  variants.push_back(variant{"scalar", &sb::equal_scalar, &sb::copy_scalar});
+#if SIMD_BYTES_X86
+  variants.push_back(variant{"sse2", &sb::equal_sse2, &sb::copy_sse2});
+  if (sb::have_avx2())
+    variants.push_back(variant{"avx2", &sb::equal_avx2, &sb::copy_avx2});
+#endif
+  variants.push_back(variant{"dispatch", &sb::equal, &sb::copy});
+
+  static const std::size_t sizes[] = { 16, 32, 64, 128, 256, 512, 1024, 4096, 8192 };
+  const std::size_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+
+  // Offset by one so nothing is conveniently aligned
+  std::vector<char> a(max_size + 1), b(max_size + 1), dst(max_size + 1);
+  for (std::size_t i = 0; i < a.size(); ++i)
+    a[i] = b[i] = static_cast<char>('A' + i % 26);
+
+  std::cout << std::left << std::setw(10) << "impl" << std::right << std::setw(8) << "size"
+            << std::setw(14) << "equal ns" << std::setw(14) << "copy ns" << "\n";
+  for (std::size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    for (std::size_t v = 0; v < variants.size(); ++v) {
+      const std::size_t n = sizes[s];
+      std::cout << std::left << std::setw(10) << variants[v].name << std::right
+                << std::setw(8) << n << std::fixed << std::setprecision(1)
+                << std::setw(14) << time_equal(variants[v].equal, &a[1], &b[1], n)
+                << std::setw(14) << time_copy(variants[v].copy, &dst[1], &a[1], n) << "\n";
+    }
+  }
+
+  return EX_OK;
+}
@@ -0,0 +1,379 @@
+// Contention benchmark for stackoverflow::Example: N threads hammering one
+// Example with a weighted mix of foo(), foo_snapshot(), foo_set(), bar()
+// and bar_set(). Reports throughput and latency percentiles per operation
+// so lock backends can be compared on the same box with the same mix.
+//
+// With -o it instead creates, reads and destroys that many Examples, once
+// with new/delete and once through an ExamplePool, and reports time and
+// heap bytes per object and the cost of a bar() call on a cold object.
+//
+// Built with -DLOCK_STATS=1 (example_bench_lock_stats) it also prints the
+// wait and hold times of every lock site on exit, see lock_policy.hpp.
+
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+#include "example.hpp"
+#include "example_pool.hpp"
+#include "log_histogram.hpp"
+
+namespace {
+  // Heap usage of the calling thread, for -o
+  thread_local std::size_t allocated_bytes = 0;
+  thread_local std::size_t allocations = 0;
+} // anon namespace
+
+// Kept out of line so the compiler doesn't pair up inlined malloc()s and
+// free()s with new and delete expressions and complain about it.
+__attribute__((noinline)) void* operator new(std::size_t size) {
+  allocated_bytes += size;
+  ++allocations;
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void* operator new(std::size_t size, std::align_val_t align) {
+  allocated_bytes += size;
+  ++allocations;
+  const std::size_t a = static_cast<std::size_t>(align);
+  if (void* p = std::aligned_alloc(a, (size + a - 1) / a * a))
+    return p;
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace {
+
+using stackoverflow::BasicExample;
+typedef std::chrono::steady_clock bench_clock;
+
+enum op_t { OP_FOO, OP_FOO_SNAPSHOT, OP_FOO_SET, OP_BAR, OP_BAR_SET, OP_COUNT };
+const char* const op_names[OP_COUNT] = {
+  "foo", "foo_snapshot", "foo_set", "bar", "bar_set"
+};
+
+
+struct bench_config {
+  std::string lock = "boost";
+  std::size_t threads = std::max(1u, boost::thread::hardware_concurrency());
+  std::size_t value_size = 8;
+  std::size_t objects = 0;
+  unsigned seconds = 2;
+  unsigned weights[OP_COUNT] = { 90, 0, 1, 8, 1 };
+};
+
+
+// Per-thread results, each allocated separately so threads don't share a
+// cache line while they're recording. One latency histogram (ns) per op,
+// merged after the run.
+struct thread_result {
+  log_histogram h[OP_COUNT];
+  std::uint64_t sink = 0;
+};
+
+
+template <typename ExampleT>
+void
+worker(const bench_config& cfg, ExampleT& e, const std::atomic<bool>& start,
+       const std::atomic<bool>& stop, std::size_t id, thread_result& r) {
+  // Two values per thread so that each set actually changes foo/bar.
+  const char base = 'A' + (id % 26);
+  const std::string values[2] = {
+    std::string(cfg.value_size, base), std::string(cfg.value_size, base + 32)
+  };
+  const std::size_t bar_len = e.bar_capacity();
+  std::string bar_values[2] = {
+    std::string(bar_len, base), std::string(bar_len, base + 32)
+  };
+  std::unique_ptr<char[]> bar_buf(new char[bar_len]);
+
+  unsigned cumulative[OP_COUNT];
+  unsigned total = 0;
+  for (std::size_t i = 0; i < OP_COUNT; ++i)
+    cumulative[i] = (total += cfg.weights[i]);
+
+  std::minstd_rand rng(id + 1);
+  std::uniform_int_distribution<unsigned> pick(0, total - 1);
+  unsigned flip = 0;
+
+  while (!start.load(std::memory_order_acquire))
+    ;
+
+  while (!stop.load(std::memory_order_relaxed)) {
+    const unsigned x = pick(rng);
+    std::size_t op = 0;
+    while (x >= cumulative[op])
+      ++op;
+
+    const bench_clock::time_point t0 = bench_clock::now();
+    switch (op) {
+    case OP_FOO:
+      r.sink += e.foo().size();
+      break;
+    case OP_FOO_SNAPSHOT:
+      r.sink += e.foo_snapshot()->size();
+      break;
+    case OP_FOO_SET:
+      r.sink += e.foo_set(values[++flip & 1]);
+      break;
+    case OP_BAR:
+      r.sink += e.bar(bar_len, bar_buf.get());
+      break;
+    case OP_BAR_SET:
+      r.sink += e.bar_set(bar_len, bar_values[++flip & 1].c_str());
+      break;
+    }
+    const bench_clock::time_point t1 = bench_clock::now();
+    r.h[op].record(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+  }
+}
+
+
+template <typename LockPolicy>
+void
+run(const bench_config& cfg) {
+  BasicExample<LockPolicy> e(std::string(cfg.value_size, '-'));
+  std::atomic<bool> start(false), stop(false);
+  std::vector<std::unique_ptr<thread_result>> results;
+  for (std::size_t i = 0; i < cfg.threads; ++i)
+    results.emplace_back(new thread_result);
+
+  boost::thread_group tg;
+  for (std::size_t i = 0; i < cfg.threads; ++i)
+    tg.create_thread([&, i]() { worker(cfg, e, start, stop, i, *results[i]); });
+
+  const bench_clock::time_point t0 = bench_clock::now();
+  start.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(std::chrono::seconds(cfg.seconds));
+  stop.store(true, std::memory_order_relaxed);
+  tg.join_all();
+  const double wall = std::chrono::duration<double>(bench_clock::now() - t0).count();
+
+  std::cout << "lock=" << cfg.lock << " threads=" << cfg.threads << " value_size=" << cfg.value_size
+            << " seconds=" << cfg.seconds
+            << " bar_lock=" << (EXAMPLE_SEQLOCK_BAR ? "seqlock" : "shared_lock")
+            << "\n";
+  std::cout << std::left << std::setw(14) << "op" << std::right
+            << std::setw(12) << "ops" << std::setw(14) << "ops/s"
+            << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns"
+            << std::setw(10) << "p999 ns" << std::setw(12) << "max ns" << "\n";
+
+  std::uint64_t sink = 0;
+  for (std::size_t op = 0; op < OP_COUNT; ++op) {
+    log_histogram h;
+    for (std::size_t i = 0; i < cfg.threads; ++i)
+      h.merge(results[i]->h[op]);
+    if (h.count() == 0)
+      continue;
+    std::cout << std::left << std::setw(14) << op_names[op] << std::right
+              << std::setw(12) << h.count()
+              << std::setw(14) << std::fixed << std::setprecision(0) << h.count() / wall
+              << std::setw(10) << h.percentile(50.0) << std::setw(10) << h.percentile(99.0)
+              << std::setw(10) << h.percentile(99.9) << std::setw(12) << h.max() << "\n";
+  }
+  for (std::size_t i = 0; i < cfg.threads; ++i)
+    sink += results[i]->sink;
+
+  // Keeps the reads from being optimized away
+  if (sink == 0)
+    std::cout << "(no work done)\n";
+}
+
+
+// Creates cfg.objects Examples through Alloc, calls bar() on each of them
+// in random order, then destroys them.
+template <typename ExampleT, typename Alloc>
+void
+run_objects(const bench_config& cfg, const char* name, Alloc& alloc) {
+  const std::size_t n = cfg.objects;
+  const std::string init(cfg.value_size, 'x');
+  std::vector<ExampleT*> objs(n);
+  std::vector<std::size_t> order(n);
+  for (std::size_t i = 0; i < n; ++i)
+    order[i] = i;
+  std::shuffle(order.begin(), order.end(), std::minstd_rand(42));
+
+  const std::size_t bytes0 = allocated_bytes, allocs0 = allocations;
+  const bench_clock::time_point t0 = bench_clock::now();
+  for (std::size_t i = 0; i < n; ++i)
+    objs[i] = alloc.create(init);
+  const bench_clock::time_point t1 = bench_clock::now();
+  const std::size_t bytes = allocated_bytes - bytes0, allocs = allocations - allocs0;
+
+  const std::size_t bar_len = objs[0]->bar_capacity();
+  std::unique_ptr<char[]> buf(new char[bar_len]);
+  std::uint64_t sink = 0;
+  const bench_clock::time_point t2 = bench_clock::now();
+  for (std::size_t i = 0; i < n; ++i)
+    sink += objs[order[i]]->bar(bar_len, buf.get());
+  const bench_clock::time_point t3 = bench_clock::now();
+
+  for (std::size_t i = 0; i < n; ++i)
+    alloc.destroy(objs[i]);
+  const bench_clock::time_point t4 = bench_clock::now();
+
+  const auto per_obj = [n](bench_clock::duration d) {
+    return std::chrono::duration<double, std::nano>(d).count() / n;
+  };
+  std::cout << std::left << std::setw(8) << name << std::right << std::fixed
+            << std::setprecision(1)
+            << std::setw(14) << per_obj(t1 - t0) << std::setw(14) << per_obj(t4 - t3)
+            << std::setw(12) << double(bytes) / n << std::setw(12) << double(allocs) / n
+            << std::setw(14) << per_obj(t3 - t2) << "\n";
+  if (sink != n)
+    std::cout << "(bar() failed)\n";
+}
+
+
+// new/delete with the same interface as ExamplePool
+template <typename T>
+struct heap_alloc {
+  template <typename... Args>
+  T* create(Args&&... args) { return new T(std::forward<Args>(args)...); }
+  void destroy(T* obj) { delete obj; }
+};
+
+
+template <typename LockPolicy>
+void
+run_objects(const bench_config& cfg) {
+  typedef BasicExample<LockPolicy> ExampleT;
+
+  std::cout << "lock=" << cfg.lock << " objects=" << cfg.objects
+            << " value_size=" << cfg.value_size
+            << " impl=" << (EXAMPLE_INLINE_IMPL ? "inline" : "heap")
+            << " sizeof(Example)=" << sizeof(ExampleT) << "\n";
+  std::cout << std::left << std::setw(8) << "alloc" << std::right
+            << std::setw(14) << "create ns" << std::setw(14) << "destroy ns"
+            << std::setw(12) << "heap bytes" << std::setw(12) << "allocs"
+            << std::setw(14) << "bar() ns" << "\n";
+
+  heap_alloc<ExampleT> heap;
+  run_objects<ExampleT>(cfg, "new", heap);
+  {
+    stackoverflow::ExamplePool<ExampleT> pool;
+    run_objects<ExampleT>(cfg, "pool", pool);
+  }
+}
+
+
+template <typename LockPolicy>
+void
+dispatch(const bench_config& cfg) {
+  if (cfg.objects > 0)
+    run_objects<LockPolicy>(cfg);
+  else
+    run<LockPolicy>(cfg);
+}
+
+
+// "foo=90,bar=8,foo_set=1,bar_set=1". Ops left out aren't run.
+bool
+parse_mix(const std::string& spec, unsigned (&weights)[OP_COUNT]) {
+  std::fill(weights, weights + OP_COUNT, 0);
+  std::istringstream in(spec);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    const std::string::size_type eq = item.find('=');
+    if (eq == std::string::npos)
+      return false;
+    const std::string name = item.substr(0, eq);
+    std::size_t op = 0;
+    while (op < OP_COUNT && name != op_names[op])
+      ++op;
+    if (op == OP_COUNT)
+      return false;
+    weights[op] = std::strtoul(item.c_str() + eq + 1, nullptr, 10);
+  }
+
+  unsigned total = 0;
+  for (std::size_t i = 0; i < OP_COUNT; ++i)
+    total += weights[i];
+  return total > 0;
+}
+
+
+void
+usage() {
+  std::cerr << "example_bench [-l lock] [-t threads] [-s value_size] [-d seconds] [-m mix]\n"
+            << "example_bench [-l lock] [-s value_size] -o objects\n"
+            << "\t-l lock\t\tLock policy: boost, std or distributed (default: boost)\n"
+            << "\t-o objects\tMeasure creating, reading and destroying this many objects\n"
+            << "\t-t threads\tNumber of threads (default: number of CPUs)\n"
+            << "\t-s value_size\tSize of the values foo_set() writes (default: 8)\n"
+            << "\t-d seconds\tHow long to run (default: 2)\n"
+            << "\t-m mix\t\tOperation weights, e.g. foo=90,bar=8,foo_set=1,bar_set=1\n"
+            << "\t\t\tOps: foo foo_snapshot foo_set bar bar_set\n";
+}
+
+} // anon namespace
+
+
+int
+main(const int argc, char* const argv[]) {
+  bench_config cfg;
+
+  int ch;
+  while ((ch = ::getopt(argc, argv, "d:l:m:o:s:t:")) != -1) {
+    switch (ch) {
+    case 'd': cfg.seconds = std::strtoul(optarg, nullptr, 10); break;
+    case 'l': cfg.lock = optarg; break;
+    case 'm':
+      if (!parse_mix(optarg, cfg.weights)) {
+        usage();
+        return EX_USAGE;
+      }
+      break;
+    case 'o': cfg.objects = std::strtoul(optarg, nullptr, 10); break;
+    case 's': cfg.value_size = std::strtoul(optarg, nullptr, 10); break;
+    case 't': cfg.threads = std::strtoul(optarg, nullptr, 10); break;
+    default:
+      usage();
+      return EX_USAGE;
+    }
+  }
+
+  if (cfg.threads == 0 || cfg.value_size == 0) {
+    usage();
+    return EX_USAGE;
+  }
+
+  if (cfg.lock == "boost")
+    dispatch<stackoverflow::BoostLockPolicy>(cfg);
+#if EXAMPLE_STD_LOCK_POLICY
+  else if (cfg.lock == "std")
+    dispatch<stackoverflow::StdLockPolicy>(cfg);
+#endif
+  else if (cfg.lock == "distributed")
+    dispatch<stackoverflow::DistributedLockPolicy>(cfg);
+  else {
+    usage();
+    return EX_USAGE;
+  }
+#if LOCK_STATS
+  lock_stats::dump(std::cout);
+#endif
+  return EX_OK;
+}
@@ -1,11 +1,272 @@
 #include <sysexits.h>
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <new>
 #include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
 
 #include "example.hpp"
+#include "example_registry.hpp"
+#include "example_snapshot.hpp"
+
+namespace {
+  std::atomic<unsigned long> allocations(0);
+} // anon namespace
+
+// Count every heap allocation so foo_set_allocation_test() can check that
+// updates don't allocate. Kept out of line so the compiler doesn't pair up
+// inlined malloc()s and free()s with new and delete expressions and complain.
+__attribute__((noinline)) void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+  // Once foo has grown to fit, updating it through any of the C string or
+  // string_view setters must not allocate.
+  void foo_set_allocation_test() {
+    using stackoverflow::Example;
+    static const char a[] = "a value that's too long for the small string optimization";
+    char b[sizeof(a)];
+    std::memcpy(b, a, sizeof(a));
+    b[0] = 'A';
+    const char* const a_ptr = a;
+
+    Example e;
+    e.foo_set(a);
+    assert(e.foo() == a);   // The literal's NUL isn't part of foo
+    assert(e.foo().size() == sizeof(a) - 1);
+
+    const unsigned long before = allocations.load();
+    for (int i = 0; i < 1000; ++i) {
+      e.foo_set(b);
+      e.foo_set(a_ptr);
+      e.foo_set(boost::string_view(b, sizeof(b) - 1));
+      e.foo_set(a);
+    }
+    const unsigned long after = allocations.load();
+    assert(after == before);
+    std::cout << "foo_set() allocations over 4000 updates: " << (after - before) << std::endl;
+  }
+
+  // Only real changes bump the version, and a waiter sleeping in
+  // wait_for_change() wakes up for them.
+  void wait_for_change_test() {
+    using stackoverflow::Example;
+    Example e;
+    const Example::version_t v0 = e.version();
+    assert(!e.foo_set(e.foo()));   // Same value, no change
+    assert(e.version() == v0);
+    assert(e.wait_for_change(v0, std::chrono::milliseconds(10)) == v0);
+
+    Example::version_t woke_with = v0;
+    boost::thread waiter([&e, &woke_with, v0]() {
+      woke_with = e.wait_for_change(v0, std::chrono::seconds(10));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    e.foo_set("changed");
+    waiter.join();
+    assert(woke_with == v0 + 1 && e.version() == v0 + 1);
+
+    const char bar[] = "bar";
+    e.bar_set(sizeof(bar) - 1, bar);
+    assert(e.wait_for_change(v0 + 1, std::chrono::seconds(0)) == v0 + 2);
+  }
+
+  // bar() can read a prefix of bar, bar_set() can write one
+  void bar_partial_test() {
+    using stackoverflow::Example;
+    Example e;
+    const std::size_t cap = e.bar_capacity();
+    std::string full(cap, 'x');
+    for (std::size_t i = 0; i < cap; ++i)
+      full[i] = 'A' + (i % 26);
+    assert(e.bar_set(cap, full.data()));
+    assert(!e.bar_set(cap, full.data()));       // Same value as foo
+    assert(!e.bar_set(cap + 1, full.data()));   // Too big
+
+    std::string buf(cap, '\0');
+    assert(e.bar(cap / 2, &buf[0]));
+    assert(buf.compare(0, cap / 2, full, 0, cap / 2) == 0);
+    assert(!e.bar(cap + 1, &buf[0]));
+
+    assert(e.bar_set(1, "z"));
+    assert(e.bar(cap, &buf[0]));
+    assert(buf[0] == 'z' && buf.compare(1, cap - 1, full, 1, cap - 1) == 0);
+    assert(e.foo() == "z");
+  }
+
+  // The registry's batched calls agree with the single key ones, and
+  // for_each() keeps going while other threads insert, set and erase.
+  void registry_test() {
+    using stackoverflow::Example;
+    typedef stackoverflow::ExampleRegistry<> registry_t;
+    registry_t reg;
+
+    assert(reg.insert("a", "1").second);
+    assert(!reg.insert("a", "other").second);
+    assert(reg.find("a")->foo() == "1");
+    assert(!reg.find("missing"));
+
+    std::vector<std::string> keys, values;
+    for (int i = 0; i < 200; ++i) {
+      keys.push_back("key" + std::to_string(i));
+      values.push_back("value" + std::to_string(i));
+    }
+    assert(reg.multi_set(keys, values) == keys.size());
+    assert(reg.multi_set(keys, values) == 0);   // Nothing changed
+    assert(reg.size() == keys.size() + 1);
+    // A new key counts as changed even if its value is Example's default
+    assert(reg.multi_set({"new"}, {"default foo value"}) == 1);
+    assert(reg.find("new")->foo() == "default foo value");
+    assert(reg.erase("new"));
+
+    keys.push_back("missing");
+    const std::vector<boost::optional<std::string>> got = reg.multi_get(keys);
+    for (std::size_t i = 0; i + 1 < keys.size(); ++i)
+      assert(got[i] && *got[i] == values[i] && reg.find(keys[i])->foo() == values[i]);
+    assert(!got.back());
+
+    // Erased entries stay alive for whoever still holds them
+    std::shared_ptr<Example> a = reg.find("a");
+    assert(reg.erase("a") && !reg.erase("a"));
+    assert(!reg.find("a") && a->foo() == "1");
+
+    std::atomic<bool> done(false);
+    boost::thread writer([&reg, &done]() {
+      for (int i = 0; !done.load(std::memory_order_relaxed); ++i) {
+        const std::string key = "churn" + std::to_string(i % 64);
+        reg.insert(key).first->foo_set(std::to_string(i));
+        if (i % 3 == 0)
+          reg.erase(key);
+      }
+    });
+    std::size_t seen = 0;
+    for (int pass = 0; pass < 100; ++pass) {
+      reg.for_each([&seen](const std::string& key, Example& e) {
+        if (key.compare(0, 3, "key") == 0)
+          ++seen;
+        e.foo();
+      });
+    }
+    done.store(true, std::memory_order_relaxed);
+    writer.join();
+    assert(seen == 100 * values.size());
+  }
+
+  // A registry survives a round trip through a snapshot file, large foos
+  // stay in the mapping until they're set, and files this build can't read
+  // are rejected.
+  void snapshot_test() {
+    using stackoverflow::Example;
+    using stackoverflow::ExampleSnapshot;
+    typedef stackoverflow::ExampleRegistry<> registry_t;
+    static const char path[] = "example_main.snap";
+
+    registry_t reg;
+    const std::string big(1000, 'x');
+    reg.insert("small", "s");
+    reg.insert("big", big);
+    const std::size_t cap = reg.find("small")->bar_capacity();
+    const std::string bar(cap, 'b');
+    reg.find("small")->bar_set(cap, bar.data());
+    reg.find("small")->foo_set("s");    // bar_set() set foo too
+
+    {
+      stackoverflow::ExampleSnapshotWriter w;
+      reg.snapshot(w);
+      assert(w.size() == 2);
+      w.write(path);
+    }
+
+    std::shared_ptr<const ExampleSnapshot> snap = ExampleSnapshot::open(path);
+    assert(snap->size() == 2);
+    registry_t restored;
+    assert(restored.restore(*snap) == 2);
+    assert(restored.find("small")->foo() == "s");
+    assert(restored.find("big")->foo() == big);
+    std::string buf(cap, '\0');
+    assert(restored.find("small")->bar(cap, &buf[0]) && buf == bar);
+
+    // Only "big" is left in the mapping, and setting it lets go
+    const long refs = snap.use_count();
+    assert(refs == 2);
+    assert(!restored.find("big")->foo_set(big));   // Same value, still mapped
+    assert(restored.find("big")->foo_set("new"));
+    assert(snap.use_count() == 1 && restored.find("big")->foo() == "new");
+    snap.reset();
+
+    {
+      std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+      f.seekp(0);
+      f.write("garbage!", 8);
+    }
+    bool rejected = false;
+    try {
+      ExampleSnapshot::open(path);
+    } catch (const std::runtime_error&) {
+      rejected = true;
+    }
+    assert(rejected);
+    std::remove(path);
+  }
+
+  // Readers racing a bar_set() loop must only ever see one of the two
+  // values, never a mix of the two (i.e. a torn read), in either bar or foo.
+  // Run once per lock policy.
+  template <typename ExampleT>
+  void torn_read_test() {
+    static const std::size_t readers = 4;
+    static const int writes = 100000;
+
+    ExampleT e;
+    const std::size_t len = e.bar_capacity();
+    const std::string a(len, 'a'), b(len, 'b');
+    e.bar_set(len, a.c_str());
+
+    std::atomic<bool> done(false);
+    bool torn[readers] = {};
+    boost::thread_group tg;
+    for (std::size_t i = 0; i < readers; ++i) {
+      tg.create_thread([&e, &done, &torn, &a, &b, len, i]() {
+        std::unique_ptr<char[]> buf(new char[len]);
+        while (!done.load(std::memory_order_relaxed)) {
+          if (!e.bar(len, buf.get()))
+            throw std::runtime_error("Unable to get bar");
+          if (std::memcmp(buf.get(), a.data(), len) != 0 && std::memcmp(buf.get(), b.data(), len) != 0)
+            torn[i] = true;
+          const std::string foo = e.foo();
+          if (foo != a && foo != b)
+            torn[i] = true;
+        }
+      });
+    }
+
+    for (int i = 0; i < writes; ++i)
+      e.bar_set(len, (i & 1) ? a.c_str() : b.c_str());
+    done.store(true, std::memory_order_relaxed);
+    tg.join_all();
+
+    for (std::size_t i = 0; i < readers; ++i)
+      assert(!torn[i]);
+  }
+} // anon namespace
 
 int
 main(const int /*argc*/, const char** /*argv*/) {
@@ -59,6 +320,17 @@ main(const int /*argc*/, const char** /*argv*/) {
       assert(e.foo() == "foobar");
     }
 
+    { // Snapshots are immutable and outlive later foo_set() calls
+      Example::foo_snapshot_t before = e.foo_snapshot();
+      assert(*before == "foobar");
+      assert(e.foo_snapshot() == before);   // No new version, same object
+      e.foo_set("snapshot");
+      Example::foo_snapshot_t after = e.foo_snapshot();
+      assert(*before == "foobar");
+      assert(after != before && *after == e.foo());
+      e.foo_set(std::string("foobar"));
+    }
+
     cout << "Example's bar capacity: " << e.bar_capacity() << endl;
     const std::size_t len = e.bar_capacity();
 
@@ -80,6 +352,17 @@ main(const int /*argc*/, const char** /*argv*/) {
     cout << endl << "foo and bar now have identical values but only one lock was acquired when setting:" << endl;
     cout << "Example's foo value: " << e.foo() << endl;
     cout << "Example's bar value: " << buf.get() << endl;
+
+    foo_set_allocation_test();
+    bar_partial_test();
+    wait_for_change_test();
+    registry_test();
+    snapshot_test();
+    torn_read_test<Example>();
+#if EXAMPLE_STD_LOCK_POLICY
+    torn_read_test<stackoverflow::BasicExample<stackoverflow::StdLockPolicy>>();
+#endif
+    torn_read_test<stackoverflow::BasicExample<stackoverflow::DistributedLockPolicy>>();
   } catch (...) {
     return EX_SOFTWARE;
   }
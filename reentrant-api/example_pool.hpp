@@ -0,0 +1,100 @@
+#ifndef EXAMPLE_POOL_HPP
+#define EXAMPLE_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/assert.hpp>
+
+namespace stackoverflow {
+
+// Object pool for creating and destroying Examples (or anything else) in
+// bulk. Objects are carved out of chunks of ChunkSize slots, and a destroyed
+// object's slot goes on a free list for the next create(), so a million
+// objects cost a thousand allocations instead of a million (two million
+// without EXAMPLE_INLINE_IMPL) and sit next to each other in memory.
+//
+// Not thread safe: use one pool per thread or lock around it. Every object
+// has to be destroy()ed before the pool goes away.
+//
+//   ExamplePool<Example> pool;
+//   Example* e = pool.create("initial foo");
+//   ...
+//   pool.destroy(e);
+template <typename T, std::size_t ChunkSize = 1024>
+class ExamplePool final {
+public:
+  ExamplePool() : free_(nullptr), live_(0) {}
+  ExamplePool(const ExamplePool&) = delete;
+  ExamplePool& operator=(const ExamplePool&) = delete;
+
+  ~ExamplePool() {
+    BOOST_ASSERT(live_ == 0);
+  }
+
+  template <typename... Args>
+  T* create(Args&&... args) {
+    if (!free_)
+      grow();
+    // Unlink first: the object overwrites next
+    Slot* s = free_;
+    free_ = s->next;
+    try {
+      T* obj = new (&s->storage) T(std::forward<Args>(args)...);
+      ++live_;
+      return obj;
+    } catch (...) {
+      s->next = free_;
+      free_ = s;
+      throw;
+    }
+  }
+
+  void destroy(T* obj) {
+    if (!obj)
+      return;
+    obj->~T();
+    Slot* s = reinterpret_cast<Slot*>(obj);
+    s->next = free_;
+    free_ = s;
+    --live_;
+  }
+
+  // Number of objects currently alive
+  std::size_t size() const { return live_; }
+
+  // Number of slots allocated
+  std::size_t capacity() const { return chunks_.size() * ChunkSize; }
+
+  // For std::unique_ptr<T, deleter>
+  struct deleter {
+    ExamplePool* pool;
+    void operator()(T* obj) const { pool->destroy(obj); }
+  };
+
+private:
+  union Slot {
+    Slot* next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  void grow() {
+    std::unique_ptr<Slot[]> chunk(new Slot[ChunkSize]);
+    for (std::size_t i = 0; i < ChunkSize; ++i)
+      chunk[i].next = i + 1 < ChunkSize ? &chunk[i + 1] : free_;
+    free_ = &chunk[0];
+    chunks_.push_back(std::move(chunk));
+  }
+
+  std::vector<std::unique_ptr<Slot[]>> chunks_;
+  Slot* free_;
+  std::size_t live_;
+};
+
+} // namespace stackoverflow
+
+#endif // EXAMPLE_POOL_HPP
@@ -0,0 +1,244 @@
+#ifndef EXAMPLE_REGISTRY_HPP
+#define EXAMPLE_REGISTRY_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/assert.hpp>
+#include <boost/optional.hpp>
+
+#include "example.hpp"
+#include "example_snapshot.hpp"
+
+namespace stackoverflow {
+
+// Concurrent map from name to Example, for keeping lots of them around
+// without one global lock in front of all of them. Keys are spread over
+// Stripes independently locked hash maps, so lookups only ever take the
+// shared lock of the one stripe the key hashes to, and only for as long as
+// the lookup itself. The registry's locks guard which Examples exist, not
+// their values: reading or changing a value goes through the Example, i.e.
+// its own rw_mtx_, after the stripe lock has been released.
+//
+// Entries are handed out as shared_ptrs, so an Example that's erase()d
+// while someone else is using it stays alive until they let go of it.
+//
+//   ExampleRegistry<> reg;
+//   reg.insert("answer", "42");
+//   if (std::shared_ptr<Example> e = reg.find("answer"))
+//     std::cout << e->foo();
+template <typename ExampleT = Example, std::size_t Stripes = 64,
+          typename StripeLockPolicy = BoostLockPolicy>
+class ExampleRegistry final {
+public:
+  typedef ExampleT example_t;
+  typedef std::shared_ptr<ExampleT> entry_t;
+
+  ExampleRegistry() = default;
+  ExampleRegistry(const ExampleRegistry&) = delete;
+  ExampleRegistry& operator=(const ExampleRegistry&) = delete;
+
+  // The Example stored under key, or an empty pointer
+  entry_t find(const std::string& key) const {
+    const Stripe& s = stripe_of(key);
+    shared_lock_t lk(s.mtx);
+    const typename map_t::const_iterator it = s.map.find(key);
+    return it == s.map.end() ? entry_t() : it->second;
+  }
+
+  // Adds an Example under key unless there already is one. Returns the
+  // Example stored under key and whether it was created.
+  std::pair<entry_t, bool> insert(const std::string& key, const std::string& initial_foo = std::string()) {
+    Stripe& s = stripe_of(key);
+    {
+      shared_lock_t lk(s.mtx);
+      const typename map_t::const_iterator it = s.map.find(key);
+      if (it != s.map.end())
+        return std::make_pair(it->second, false);
+    }
+    // Build the Example before taking the unique lock, so readers of this
+    // stripe don't wait on its allocation
+    entry_t e = std::make_shared<ExampleT>(initial_foo);
+    unique_lock_t lk(s.mtx);
+    const std::pair<typename map_t::iterator, bool> r = s.map.emplace(key, e);
+    return std::make_pair(r.first->second, r.second);
+  }
+
+  bool erase(const std::string& key) {
+    Stripe& s = stripe_of(key);
+    entry_t e;    // Destroyed after the lock is released
+    unique_lock_t lk(s.mtx);
+    const typename map_t::iterator it = s.map.find(key);
+    if (it == s.map.end())
+      return false;
+    e.swap(it->second);
+    s.map.erase(it);
+    return true;
+  }
+
+  // Batched find(): out[i] is the Example stored under keys[i], or an empty
+  // pointer. Keys are grouped by stripe, so each stripe is locked once no
+  // matter how many of the keys land in it.
+  std::vector<entry_t> find(const std::vector<std::string>& keys) const {
+    std::vector<entry_t> out(keys.size());
+    const std::vector<std::pair<std::size_t, std::size_t>> order = by_stripe(keys);
+    for (std::size_t i = 0; i < order.size();) {
+      const Stripe& s = stripes_[order[i].first];
+      shared_lock_t lk(s.mtx);
+      for (const std::size_t stripe = order[i].first; i < order.size() && order[i].first == stripe; ++i) {
+        const typename map_t::const_iterator it = s.map.find(keys[order[i].second]);
+        if (it != s.map.end())
+          out[order[i].second] = it->second;
+      }
+    }
+    return out;
+  }
+
+  // foo() of every key, none where there's no such key
+  std::vector<boost::optional<std::string>> multi_get(const std::vector<std::string>& keys) const {
+    const std::vector<entry_t> entries = find(keys);
+    std::vector<boost::optional<std::string>> out(entries.size());
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i])
+        out[i] = entries[i]->foo();
+    }
+    return out;
+  }
+
+  // foo_set(values[i]) on keys[i], creating the Examples that don't exist
+  // yet. Each stripe is locked once for the lookups and, only if some of
+  // its keys are missing, once more to insert them with their values.
+  // Returns how many values changed, which includes every Example created.
+  std::size_t multi_set(const std::vector<std::string>& keys, const std::vector<std::string>& values) {
+    BOOST_ASSERT(keys.size() == values.size());
+    std::vector<entry_t> entries = find(keys);
+    std::vector<bool> created(entries.size(), false);
+
+    std::vector<std::string> missing;
+    std::vector<std::size_t> missing_at;
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+      if (!entries[i]) {
+        missing.push_back(keys[i]);
+        missing_at.push_back(i);
+      }
+    }
+    if (!missing.empty()) {
+      const std::vector<std::pair<std::size_t, std::size_t>> order = by_stripe(missing);
+      for (std::size_t i = 0; i < order.size();) {
+        Stripe& s = stripes_[order[i].first];
+        unique_lock_t lk(s.mtx);
+        for (const std::size_t stripe = order[i].first; i < order.size() && order[i].first == stripe; ++i) {
+          const std::size_t at = missing_at[order[i].second];
+          entry_t& slot = s.map[missing[order[i].second]];
+          if (!slot) {
+            slot = std::make_shared<ExampleT>(values[at]);
+            created[at] = true;
+          }
+          entries[at] = slot;
+        }
+      }
+    }
+
+    std::size_t changed = 0;
+    for (std::size_t i = 0; i < entries.size(); ++i)
+      changed += created[i] || entries[i]->foo_set(boost::string_view(values[i]));
+    return changed;
+  }
+
+  // Calls f(key, example) for every entry. One stripe at a time is copied
+  // under its shared lock and visited after the lock is released, so f can
+  // take as long as it likes (and even call back in to the registry)
+  // without holding up writers. Entries added or erased during the walk
+  // may or may not be seen.
+  template <typename F>
+  void for_each(F&& f) const {
+    std::vector<std::pair<std::string, entry_t>> entries;
+    for (std::size_t i = 0; i < Stripes; ++i) {
+      entries.clear();
+      {
+        shared_lock_t lk(stripes_[i].mtx);
+        entries.assign(stripes_[i].map.begin(), stripes_[i].map.end());
+      }
+      for (std::size_t j = 0; j < entries.size(); ++j)
+        f(entries[j].first, *entries[j].second);
+    }
+  }
+
+  // Adds every entry to w, keyed by name. Each Example is locked only while
+  // it's copied in to w, and no stripe is locked while that happens.
+  void snapshot(ExampleSnapshotWriter& w) const {
+    for_each([&w](const std::string& key, const ExampleT& e) { e.snapshot(w, key); });
+  }
+
+  // Loads every record of snap as a new Example, replacing whatever is
+  // stored under its key. Returns the number of records loaded.
+  std::size_t restore(const ExampleSnapshot& snap) {
+    std::size_t n = 0;
+    snap.for_each([this, &n](const ExampleSnapshotRecord& rec) {
+      entry_t e = std::make_shared<ExampleT>(rec);
+      const std::string key(rec.key().data(), rec.key().size());
+      Stripe& s = stripe_of(key);
+      unique_lock_t lk(s.mtx);
+      // The old entry, if any, goes away after the lock is released
+      s.map[key].swap(e);
+      ++n;
+    });
+    return n;
+  }
+
+  // Only exact while nothing is being inserted or erased
+  std::size_t size() const {
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < Stripes; ++i) {
+      shared_lock_t lk(stripes_[i].mtx);
+      n += stripes_[i].map.size();
+    }
+    return n;
+  }
+
+private:
+  typedef typename StripeLockPolicy::shared_mtx_t shared_mtx_t;
+  typedef typename StripeLockPolicy::shared_lock_t shared_lock_t;
+  typedef typename StripeLockPolicy::unique_lock_t unique_lock_t;
+  typedef std::unordered_map<std::string, entry_t> map_t;
+
+  // Each stripe gets its own cache line(s) so that locking one doesn't
+  // bounce its neighbours between cores.
+  struct alignas(64) Stripe {
+    mutable shared_mtx_t mtx;
+    map_t map;
+  };
+
+  static std::size_t stripe_index(const std::string& key) {
+    // The maps hash the same key again; multiplying by the golden ratio and
+    // taking the top bits keeps the stripe from correlating with the bucket.
+    const std::uint64_t h = std::hash<std::string>()(key);
+    return static_cast<std::size_t>((h * 0x9e3779b97f4a7c15ull) >> 32) % Stripes;
+  }
+
+  Stripe& stripe_of(const std::string& key) { return stripes_[stripe_index(key)]; }
+  const Stripe& stripe_of(const std::string& key) const { return stripes_[stripe_index(key)]; }
+
+  // (stripe, index in keys) for every key, sorted by stripe
+  static std::vector<std::pair<std::size_t, std::size_t>> by_stripe(const std::vector<std::string>& keys) {
+    std::vector<std::pair<std::size_t, std::size_t>> order(keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+      order[i] = std::make_pair(stripe_index(keys[i]), i);
+    std::sort(order.begin(), order.end());
+    return order;
+  }
+
+  std::array<Stripe, Stripes> stripes_;
+};
+
+} // namespace stackoverflow
+
+#endif // EXAMPLE_REGISTRY_HPP
@@ -0,0 +1,324 @@
+#ifndef EXAMPLE_SNAPSHOT_HPP
+#define EXAMPLE_SNAPSHOT_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <boost/utility/string_view.hpp>
+
+#include "example.hpp"
+
+namespace stackoverflow {
+
+// Dump and warm restart of many Examples' foo and bar through one file.
+// ExampleSnapshotWriter collects records (Example::snapshot() adds one
+// while holding that Example's shared lock for no longer than it takes to
+// copy foo and bar) and writes them out in one go. ExampleSnapshot maps
+// the file read-only, and an Example constructed from one of its records
+// copies bar but leaves a large foo in the mapping until the first
+// foo_set() replaces it. Each such Example keeps the mapping alive.
+//
+//   ExampleSnapshotWriter w;
+//   for (...) e.snapshot(w, name);
+//   w.write("examples.snap");
+//   ...
+//   std::shared_ptr<const ExampleSnapshot> snap = ExampleSnapshot::open("examples.snap");
+//   snap->for_each([](const ExampleSnapshotRecord& rec) {
+//     Example e(rec); ...
+//   });
+//
+// Format (version 1). Integers are native endian, and the header and every
+// record start on an 8 byte boundary:
+//
+//   header   char magic[8] "EXSNAP\0\0", u32 version, u32 byte_order
+//            (0x01020304), u32 bar_capacity, u32 reserved, u64 count,
+//            u64 size (of the whole file)
+//   record   u32 key_len, u32 bar_len, u64 foo_len, then the bytes of foo,
+//            key and bar, each padded to a multiple of 8
+//
+// foo immediately follows its length, so one pointer in to the mapping is
+// all an Example needs to find it.
+namespace snapshot_format {
+  static const char magic[8] = { 'E', 'X', 'S', 'N', 'A', 'P', '\0', '\0' };
+  static const std::uint32_t version = 1;
+  static const std::uint32_t byte_order = 0x01020304;
+
+  struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t bar_capacity;
+    std::uint32_t reserved;
+    std::uint64_t count;
+    std::uint64_t size;
+  };
+
+  struct RecordHeader {
+    std::uint32_t key_len;
+    std::uint32_t bar_len;
+    std::uint64_t foo_len;
+  };
+
+  inline std::size_t padded(const std::size_t n) { return (n + 7) & ~std::size_t(7); }
+
+  inline std::size_t record_size(const RecordHeader& h) {
+    return sizeof(h) + padded(h.foo_len) + padded(h.key_len) + padded(h.bar_len);
+  }
+} // namespace snapshot_format
+
+
+class ExampleSnapshot;
+
+// One Example's worth of a mapped snapshot. Only valid while the
+// ExampleSnapshot it came from is.
+class ExampleSnapshotRecord final {
+public:
+  boost::string_view foo() const { return foo_of(rec_ + offsetof(snapshot_format::RecordHeader, foo_len)); }
+  boost::string_view key() const {
+    return boost::string_view(rec_ + sizeof(hdr_) + snapshot_format::padded(hdr_.foo_len), hdr_.key_len);
+  }
+  boost::string_view bar() const {
+    return boost::string_view(rec_ + sizeof(hdr_) + snapshot_format::padded(hdr_.foo_len)
+                              + snapshot_format::padded(hdr_.key_len), hdr_.bar_len);
+  }
+
+  // foo's length and bytes in the mapping, which share ownership of it; see
+  // foo_of(). Empty when foo is shorter than the snapshot's map_min, in
+  // which case it's cheaper to copy it than to pin the mapping for it.
+  inline std::shared_ptr<const char> foo_ref() const;
+
+  // The foo that a foo_ref() points at
+  static boost::string_view foo_of(const char* ref) {
+    std::uint64_t len;
+    std::memcpy(&len, ref, sizeof(len));
+    return boost::string_view(ref + sizeof(len), len);
+  }
+
+private:
+  friend class ExampleSnapshot;
+  ExampleSnapshotRecord(const ExampleSnapshot& snap, const char* rec) : snap_(snap), rec_(rec) {
+    std::memcpy(&hdr_, rec, sizeof(hdr_));
+  }
+
+  const ExampleSnapshot& snap_;
+  const char* rec_;
+  snapshot_format::RecordHeader hdr_;
+};
+
+
+// Builds a snapshot file in memory. Records go in to chunks that are
+// allocated up front, so add() (which runs under an Example's lock) never
+// has to move what's already been added.
+class ExampleSnapshotWriter final {
+public:
+  explicit ExampleSnapshotWriter(const std::size_t chunk_size = 1 << 20)
+    : chunk_size_(chunk_size), count_(0) {}
+  ExampleSnapshotWriter(const ExampleSnapshotWriter&) = delete;
+  ExampleSnapshotWriter& operator=(const ExampleSnapshotWriter&) = delete;
+
+  void add(boost::string_view key, boost::string_view foo, const char* bar, const std::size_t bar_len) {
+    using namespace snapshot_format;
+    RecordHeader h;
+    h.key_len = static_cast<std::uint32_t>(key.size());
+    h.bar_len = static_cast<std::uint32_t>(bar_len);
+    h.foo_len = foo.size();
+
+    const std::size_t n = record_size(h);
+    if (chunks_.empty() || chunks_.back().capacity() - chunks_.back().size() < n) {
+      chunks_.push_back(std::string());
+      chunks_.back().reserve(std::max(chunk_size_, n));
+    }
+    std::string& c = chunks_.back();
+    c.append(reinterpret_cast<const char*>(&h), sizeof(h));
+    append_padded(c, foo.data(), foo.size());
+    append_padded(c, key.data(), key.size());
+    append_padded(c, bar, bar_len);
+    ++count_;
+  }
+
+  // Number of records added
+  std::size_t size() const { return count_; }
+
+  // Writes the snapshot to path + ".tmp" and renames it over path once it's
+  // on disk, so a crash never leaves a half written snapshot behind.
+  // Throws std::system_error.
+  void write(const std::string& path) const {
+    using namespace snapshot_format;
+    Header h;
+    std::memcpy(h.magic, magic, sizeof(h.magic));
+    h.version = version;
+    h.byte_order = byte_order;
+    h.bar_capacity = EXAMPLE_BAR_CAPACITY;
+    h.reserved = 0;
+    h.count = count_;
+    h.size = sizeof(h);
+    for (std::size_t i = 0; i < chunks_.size(); ++i)
+      h.size += chunks_[i].size();
+
+    const std::string tmp = path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "open " + tmp);
+    try {
+      write_all(fd, reinterpret_cast<const char*>(&h), sizeof(h));
+      for (std::size_t i = 0; i < chunks_.size(); ++i)
+        write_all(fd, chunks_[i].data(), chunks_[i].size());
+      if (::fsync(fd) != 0)
+        throw std::system_error(errno, std::generic_category(), "fsync " + tmp);
+    } catch (...) {
+      ::close(fd);
+      ::unlink(tmp.c_str());
+      throw;
+    }
+    ::close(fd);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+      throw std::system_error(errno, std::generic_category(), "rename " + tmp);
+  }
+
+private:
+  static void append_padded(std::string& c, const char* p, const std::size_t n) {
+    c.append(p, n);
+    c.append(snapshot_format::padded(n) - n, '\0');
+  }
+
+  static void write_all(const int fd, const char* p, std::size_t n) {
+    while (n > 0) {
+      const ssize_t w = ::write(fd, p, n);
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w < 0)
+        throw std::system_error(errno, std::generic_category(), "write");
+      p += w;
+      n -= static_cast<std::size_t>(w);
+    }
+  }
+
+  const std::size_t chunk_size_;
+  std::vector<std::string> chunks_;
+  std::size_t count_;
+};
+
+
+// A snapshot file mapped read-only. Opening it checks the header but
+// doesn't read the records; for_each() walks them without copying
+// anything. Always owned by a shared_ptr, because restored Examples that
+// point in to the mapping share ownership of it.
+class ExampleSnapshot final : public std::enable_shared_from_this<ExampleSnapshot> {
+public:
+  // foo values of at least map_min bytes are left in the mapping by
+  // restored Examples (see ExampleSnapshotRecord::foo_ref()). Throws
+  // std::system_error if the file can't be mapped and std::runtime_error
+  // if it isn't a snapshot this build can read.
+  static std::shared_ptr<const ExampleSnapshot> open(const std::string& path, const std::size_t map_min = 64) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      const int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), "fstat " + path);
+    }
+    const std::size_t len = static_cast<std::size_t>(st.st_size);
+    if (len < sizeof(snapshot_format::Header)) {
+      ::close(fd);
+      throw std::runtime_error(path + ": too short to be a snapshot");
+    }
+    void* base = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    const int err = errno;
+    ::close(fd);
+    if (base == MAP_FAILED)
+      throw std::system_error(err, std::generic_category(), "mmap " + path);
+
+    std::shared_ptr<ExampleSnapshot> snap(new ExampleSnapshot(static_cast<const char*>(base), len, map_min));
+    snap->check_header(path);
+    return snap;
+  }
+
+  ~ExampleSnapshot() { ::munmap(const_cast<char*>(base_), len_); }
+  ExampleSnapshot(const ExampleSnapshot&) = delete;
+  ExampleSnapshot& operator=(const ExampleSnapshot&) = delete;
+
+  // Number of records
+  std::size_t size() const { return static_cast<std::size_t>(header().count); }
+
+  // Size of the file in bytes
+  std::size_t bytes() const { return len_; }
+
+  std::size_t map_min() const { return map_min_; }
+
+  // Calls f(const ExampleSnapshotRecord&) for every record, in the order
+  // they were added. Throws std::runtime_error if a record runs past the
+  // end of the file.
+  template <typename F>
+  void for_each(F&& f) const {
+    std::size_t off = sizeof(snapshot_format::Header);
+    for (std::size_t i = 0; i < size(); ++i) {
+      snapshot_format::RecordHeader h;
+      if (len_ - off < sizeof(h))
+        throw std::runtime_error("snapshot truncated");
+      std::memcpy(&h, base_ + off, sizeof(h));
+      // Each part is checked on its own so a bogus length can't overflow
+      if (h.foo_len > len_ || h.key_len > len_ || h.bar_len > len_ ||
+          len_ - off < snapshot_format::record_size(h))
+        throw std::runtime_error("snapshot truncated");
+      f(ExampleSnapshotRecord(*this, base_ + off));
+      off += snapshot_format::record_size(h);
+    }
+  }
+
+private:
+  ExampleSnapshot(const char* base, const std::size_t len, const std::size_t map_min)
+    : base_(base), len_(len), map_min_(map_min) {}
+
+  const snapshot_format::Header& header() const {
+    return *reinterpret_cast<const snapshot_format::Header*>(base_);
+  }
+
+  void check_header(const std::string& path) const {
+    const snapshot_format::Header& h = header();
+    if (std::memcmp(h.magic, snapshot_format::magic, sizeof(h.magic)) != 0)
+      throw std::runtime_error(path + ": not a snapshot");
+    if (h.byte_order != snapshot_format::byte_order)
+      throw std::runtime_error(path + ": written on a machine with a different byte order");
+    if (h.version != snapshot_format::version)
+      throw std::runtime_error(path + ": unsupported snapshot version " + std::to_string(h.version));
+    if (h.bar_capacity != EXAMPLE_BAR_CAPACITY)
+      throw std::runtime_error(path + ": bar capacity " + std::to_string(h.bar_capacity) +
+                               " doesn't match EXAMPLE_BAR_CAPACITY");
+    if (h.size != len_)
+      throw std::runtime_error(path + ": truncated");
+  }
+
+  const char* const base_;
+  const std::size_t len_;
+  const std::size_t map_min_;
+};
+
+
+inline std::shared_ptr<const char>
+ExampleSnapshotRecord::foo_ref() const {
+  if (hdr_.foo_len < snap_.map_min())
+    return std::shared_ptr<const char>();
+  // Aliasing constructor: owns the snapshot, points at foo_len
+  return std::shared_ptr<const char>(snap_.shared_from_this(),
+                                     rec_ + offsetof(snapshot_format::RecordHeader, foo_len));
+}
+
+} // namespace stackoverflow
+
+#endif // EXAMPLE_SNAPSHOT_HPP
@@ -0,0 +1,150 @@
+// Snapshot and warm restart cost of stackoverflow::Example against object
+// count. For each count it builds that many Examples, snapshots them to a
+// file, then restores them twice from the mapping: once leaving large foo
+// values in the mapping (zero-copy) and once copying every foo, next to
+// constructing them from std::strings as a rebuild from upstream would.
+// Prints nanoseconds per object for each step.
+
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "example.hpp"
+#include "example_pool.hpp"
+#include "example_snapshot.hpp"
+
+namespace {
+
+using stackoverflow::Example;
+using stackoverflow::ExamplePool;
+using stackoverflow::ExampleSnapshot;
+using stackoverflow::ExampleSnapshotRecord;
+using stackoverflow::ExampleSnapshotWriter;
+typedef std::chrono::steady_clock bench_clock;
+
+struct bench_config {
+  std::size_t max_objects = 1000000;
+  std::size_t value_size = 256;
+  std::string path = "example_snapshot_bench.snap";
+};
+
+double
+ns_per(const bench_clock::duration d, const std::size_t n) {
+  return std::chrono::duration<double, std::nano>(d).count() / n;
+}
+
+// Restores every record of snap in to pool, returns ns per object
+double
+restore(const ExampleSnapshot& snap, ExamplePool<Example>& pool, std::vector<Example*>& objs) {
+  const bench_clock::time_point t0 = bench_clock::now();
+  snap.for_each([&pool, &objs](const ExampleSnapshotRecord& rec) { objs.push_back(pool.create(rec)); });
+  const bench_clock::time_point t1 = bench_clock::now();
+  return ns_per(t1 - t0, objs.size());
+}
+
+void
+destroy(ExamplePool<Example>& pool, std::vector<Example*>& objs) {
+  for (std::size_t i = 0; i < objs.size(); ++i)
+    pool.destroy(objs[i]);
+  objs.clear();
+}
+
+void
+run(const bench_config& cfg, const std::size_t n) {
+  ExamplePool<Example> pool;
+  std::vector<Example*> objs;
+  objs.reserve(n);
+
+  // Distinct values so nothing is shared between objects
+  std::vector<std::string> values(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    values[i] = std::to_string(i);
+    values[i].resize(cfg.value_size, 'v');
+  }
+
+  bench_clock::time_point t0 = bench_clock::now();
+  for (std::size_t i = 0; i < n; ++i)
+    objs.push_back(pool.create(values[i]));
+  const double rebuild = ns_per(bench_clock::now() - t0, n);
+
+  ExampleSnapshotWriter w;
+  t0 = bench_clock::now();
+  for (std::size_t i = 0; i < n; ++i)
+    objs[i]->snapshot(w);
+  const double snapshot = ns_per(bench_clock::now() - t0, n);
+  t0 = bench_clock::now();
+  w.write(cfg.path);
+  const double write = ns_per(bench_clock::now() - t0, n);
+  destroy(pool, objs);
+
+  t0 = bench_clock::now();
+  std::shared_ptr<const ExampleSnapshot> snap = ExampleSnapshot::open(cfg.path);
+  const double open_us = std::chrono::duration<double, std::micro>(bench_clock::now() - t0).count();
+  const std::size_t bytes = snap->bytes();
+  const double mapped = restore(*snap, pool, objs);
+  destroy(pool, objs);
+  snap.reset();
+
+  snap = ExampleSnapshot::open(cfg.path, std::numeric_limits<std::size_t>::max());
+  const double copied = restore(*snap, pool, objs);
+  destroy(pool, objs);
+  snap.reset();
+  std::remove(cfg.path.c_str());
+
+  std::cout << std::right << std::setw(10) << n << std::fixed << std::setprecision(1)
+            << std::setw(12) << double(bytes) / n
+            << std::setw(12) << rebuild << std::setw(12) << snapshot << std::setw(12) << write
+            << std::setw(12) << open_us << std::setw(12) << mapped << std::setw(12) << copied << "\n";
+}
+
+void
+usage() {
+  std::cerr << "example_snapshot_bench [-n max_objects] [-s value_size] [-f file]\n"
+            << "\t-n max_objects\tLargest object count, counts go up by 10x (default: 1000000)\n"
+            << "\t-s value_size\tSize of each foo value (default: 256)\n"
+            << "\t-f file\t\tSnapshot file to write and remove (default: example_snapshot_bench.snap)\n";
+}
+
+} // anon namespace
+
+
+int
+main(const int argc, char* const argv[]) {
+  bench_config cfg;
+
+  int ch;
+  while ((ch = ::getopt(argc, argv, "f:n:s:")) != -1) {
+    switch (ch) {
+    case 'f': cfg.path = optarg; break;
+    case 'n': cfg.max_objects = std::strtoul(optarg, nullptr, 10); break;
+    case 's': cfg.value_size = std::strtoul(optarg, nullptr, 10); break;
+    default:
+      usage();
+      return EX_USAGE;
+    }
+  }
+  if (cfg.max_objects == 0) {
+    usage();
+    return EX_USAGE;
+  }
+
+  std::cout << "value_size=" << cfg.value_size << " bar_capacity=" << EXAMPLE_BAR_CAPACITY << "\n"
+            << "all times are ns per object except open\n";
+  std::cout << std::right << std::setw(10) << "objects" << std::setw(12) << "file bytes"
+            << std::setw(12) << "rebuild" << std::setw(12) << "snapshot" << std::setw(12) << "write"
+            << std::setw(12) << "open us" << std::setw(12) << "restore" << std::setw(12) << "restore cp"
+            << "\n";
+  for (std::size_t n = 1000; n <= cfg.max_objects; n *= 10)
+    run(cfg, n);
+
+  return EX_OK;
+}
@@ -0,0 +1,72 @@
+#ifndef LOCK_POLICY_HPP
+#define LOCK_POLICY_HPP
+
+#ifndef BOOST_THREAD_SHARED_MUTEX_HPP
+# include <boost/thread/shared_mutex.hpp>
+#endif
+#include <boost/thread/locks.hpp>
+
+#if __cplusplus >= 201402L
+# include <mutex>
+# include <shared_mutex>
+#endif
+
+#include "distributed_shared_mutex.hpp"
+
+#ifndef LOCK_STATS
+# define LOCK_STATS 0
+#endif
+#if LOCK_STATS
+# include "lock_stats.hpp"
+#endif
+
+namespace stackoverflow {
+
+// A lock policy picks the mutex that BasicExample embeds and the lock types
+// that hold it for reading (shared) and writing (unique). The lock types
+// need owns_lock(), which Example::Impl asserts on.
+//
+// With -DLOCK_STATS=1 (and -I../lock-stats) every policy's lock types are
+// lock_stats' instrumented ones instead, which record the wait and hold
+// time of every shared_lock_t and unique_lock_t per lock site; see
+// lock_stats::dump(). Otherwise they're the plain boost:: or std:: ones.
+#if LOCK_STATS
+# define EXAMPLE_LOCK_TYPES(ns) \
+  typedef ::lock_stats::shared_lock< shared_mtx_t > shared_lock_t; \
+  typedef ::lock_stats::unique_lock< shared_mtx_t > unique_lock_t
+#else
+# define EXAMPLE_LOCK_TYPES(ns) \
+  typedef ::ns::shared_lock< shared_mtx_t > shared_lock_t; \
+  typedef ::ns::unique_lock< shared_mtx_t > unique_lock_t
+#endif
+
+// boost::shared_mutex, the default and what Example always used
+struct BoostLockPolicy {
+  typedef ::boost::shared_mutex shared_mtx_t;
+  EXAMPLE_LOCK_TYPES(boost);
+};
+
+// The standard library's reader-writer lock, when there is one
+#if __cplusplus >= 201402L
+# define EXAMPLE_STD_LOCK_POLICY 1
+struct StdLockPolicy {
+# if __cplusplus >= 201703L
+  typedef ::std::shared_mutex shared_mtx_t;
+# else
+  typedef ::std::shared_timed_mutex shared_mtx_t;
+# endif
+  EXAMPLE_LOCK_TYPES(std);
+};
+#else
+# define EXAMPLE_STD_LOCK_POLICY 0
+#endif
+
+// Per-core reader slots, see DistributedSharedMutex
+struct DistributedLockPolicy {
+  typedef DistributedSharedMutex shared_mtx_t;
+  EXAMPLE_LOCK_TYPES(boost);
+};
+
+} // namespace stackoverflow
+
+#endif // LOCK_POLICY_HPP